@@ -1,4 +1,6 @@
 #!/bin/sh
 source /opt/rh/devtoolset-7/enable
 export LD_LIBRARY_PATH=/usr/local/lib/python3.6/site-packages/mxnet:$LD_LIBRARY_PATH
-g++ -L/usr/local/lib/python3.6/site-packages/mxnet -Iinclude -w -std=c++11 -lmxnet -O3 -DNDEBUG src/game.cc src/network.cc src/mcts.cc src/train.cc src/main.cc -o gomoku
+g++ -L/usr/local/lib/python3.6/site-packages/mxnet -Iinclude -w -std=c++11 -pthread -lmxnet -O3 -DNDEBUG src/game.cc src/random.cc src/network.cc src/mcts.cc src/threat.cc src/train.cc src/mapped_file.cc src/tcp.cc src/protocol.cc src/analyze.cc src/record.cc src/ladder.cc src/main.cc -o gomoku
+g++ -L/usr/local/lib/python3.6/site-packages/mxnet -Iinclude -w -std=c++11 -pthread -lmxnet -O3 -DNDEBUG src/game.cc src/random.cc src/network.cc src/mcts.cc src/threat.cc src/mapped_file.cc src/bench.cc -o gomoku-bench
+g++ -L/usr/local/lib/python3.6/site-packages/mxnet -Iinclude -w -std=c++11 -pthread -lmxnet -O3 -DNDEBUG src/game.cc src/random.cc src/network.cc src/mcts.cc src/threat.cc src/mapped_file.cc src/test.cc -o gomoku-test
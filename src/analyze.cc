@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+#include "analyze.h"
+#include "mcts.h"
+
+struct AnalyzeJob {
+    int line_no;
+    std::string error;
+    State state;
+    MCTSNode *root = nullptr;
+    float net_value = 0.0f;
+};
+
+bool parse_position(const std::string &line, State &state, std::string &error) {
+    std::istringstream line_stream(line);
+    std::string token;
+    while (line_stream >> token) {
+        std::istringstream move_stream(token);
+        int row, col;
+        char comma;
+        if (!(move_stream >> row >> comma >> col) || comma != ',' || !ON_BOARD(row, col)) {
+            error = "malformed move " + token;
+            return false;
+        }
+        Move mv(row, col);
+        if (state.over() || !state.valid(mv)) {
+            error = "illegal move " + token;
+            return false;
+        }
+        state.next(mv);
+    }
+    if (state.over()) {
+        error = "game is already over";
+        return false;
+    }
+    return true;
+}
+
+// one simulation on every tree per round, leaves of all trees evaluated by a single batched forward
+void search_group(FIRNet &net, std::vector<AnalyzeJob*> &group, int itermax) {
+    std::vector<MCTSNode*> leaves;
+    std::vector<State> leaf_states;
+    std::vector<const State*> leaf_ptrs;
+    std::vector<int> leaf_jobs;
+    std::vector<float> values(group.size());
+    std::vector<std::vector<std::pair<Move, float>>> move_priors;
+    for (int i = 0; i < itermax; ++i) {
+        leaves.clear();
+        leaf_states.clear();
+        leaf_jobs.clear();
+        for (int j = 0; j < group.size(); ++j) {
+            State state_copied(group[j]->state);
+            MCTSNode *node = descend(group[j]->root, state_copied, C_PUCT);
+            if (settle_leaf(node, state_copied)) {
+                if (node->is_root())
+                    group[j]->net_value = 1.0f;
+                continue;
+            }
+            leaves.push_back(node);
+            leaf_states.push_back(state_copied);
+            leaf_jobs.push_back(j);
+        }
+        if (leaves.empty())
+            continue;
+        leaf_ptrs.clear();
+        for (const auto &state : leaf_states)
+            leaf_ptrs.push_back(&state);
+        net.forward_batch(leaf_ptrs, values.data(), move_priors);
+        for (int k = 0; k < leaves.size(); ++k) {
+            if (leaves[k]->is_root())
+                group[leaf_jobs[k]]->net_value = values[k];
+            expand_leaf(leaves[k], leaf_states[k], values[k], move_priors[k]);
+        }
+    }
+}
+
+void write_result(std::ostream &out, const AnalyzeJob &job, int top_n) {
+    out << "{\"line\": " << job.line_no;
+    if (!job.error.empty()) {
+        out << ", \"error\": \"";
+        for (char ch : job.error)
+            out << (ch == '"' || ch == '\\' ? "?" : std::string(1, ch));
+        out << "\"}";
+        return;
+    }
+    std::vector<std::pair<Move, const MCTSNode*>> children(
+        job.root->get_children().begin(), job.root->get_children().end());
+    std::sort(children.begin(), children.end(), [](const std::pair<Move, const MCTSNode*> &a,
+            const std::pair<Move, const MCTSNode*> &b) {
+        if (a.second->get_visits() != b.second->get_visits())
+            return a.second->get_visits() > b.second->get_visits();
+        return a.second->get_prior() > b.second->get_prior();
+    });
+    int visits = std::max(job.root->get_visits() - 1, 1);
+    out << std::fixed << std::setprecision(4)
+        << ", \"to_move\": \"" << (job.state.current() == Color::Black ? "black" : "white") << "\""
+        << ", \"visits\": " << job.root->get_visits() << ", \"value\": " << -job.root->get_quality()
+        << ", \"net_value\": " << job.net_value << ", \"moves\": [";
+    for (int i = 0; i < top_n && i < children.size(); ++i) {
+        const auto &child = children[i];
+        out << (i > 0 ? ", " : "") << "{\"move\": \"" << child.first.r() << "," << child.first.c() << "\""
+            << ", \"visits\": " << child.second->get_visits()
+            << ", \"share\": " << float(child.second->get_visits()) / visits
+            << ", \"prior\": " << child.second->get_prior()
+            << ", \"value\": " << child.second->get_quality() << "}";
+    }
+    out << "]}";
+}
+
+int analyze(long long verno, std::istream &in, std::ostream &out, int itermax, int top_n, int thread_num,
+        bool ensemble) {
+    LOG(INFO) << "analyze positions with itermax=" << itermax << ", threads=" << thread_num << ", ensemble=" << ensemble;
+    std::mutex in_mtx;
+    std::mutex out_mtx;
+    int line_no = 0;
+    long long next_group = 0;
+    long long written = 0;
+    long long positions = 0;
+    std::map<long long, std::vector<std::string>> ready;
+    // reads up to ANALYZE_BATCH_SIZE positions, returns group number ordering output or -1 at end of input
+    auto read_group = [&](std::vector<AnalyzeJob> &jobs) -> long long {
+        std::lock_guard<std::mutex> lock(in_mtx);
+        jobs.clear();
+        std::string line;
+        while (jobs.size() < ANALYZE_BATCH_SIZE && std::getline(in, line)) {
+            ++line_no;
+            line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+            if (line.find_first_not_of(" \t") == std::string::npos)
+                continue;
+            jobs.emplace_back();
+            jobs.back().line_no = line_no;
+            parse_position(line, jobs.back().state, jobs.back().error);
+        }
+        positions += jobs.size();
+        return jobs.empty() ? -1 : next_group++;
+    };
+    auto work = [&] {
+        FIRNet net(verno, true);
+        net.set_ensemble(ensemble);
+        net.bind_batch(ANALYZE_BATCH_SIZE);
+        std::vector<AnalyzeJob> jobs;
+        std::vector<AnalyzeJob*> group;
+        for (;;) {
+            long long group_no = read_group(jobs);
+            if (group_no < 0)
+                break;
+            group.clear();
+            for (auto &job : jobs) {
+                if (job.error.empty()) {
+                    job.root = new MCTSNode(nullptr, 1.0f);
+                    group.push_back(&job);
+                }
+            }
+            search_group(net, group, itermax);
+            std::vector<std::string> texts;
+            for (auto &job : jobs) {
+                std::ostringstream text;
+                write_result(text, job, top_n);
+                texts.push_back(text.str());
+                delete job.root;
+                job.root = nullptr;
+            }
+            std::lock_guard<std::mutex> lock(out_mtx);
+            ready[group_no] = std::move(texts);
+            while (!ready.empty() && ready.begin()->first == written) {
+                for (const auto &text : ready.begin()->second)
+                    out << text << "\n";
+                ready.erase(ready.begin());
+                ++written;
+            }
+            out.flush();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < thread_num; ++i)
+        threads.emplace_back(work);
+    for (auto &t : threads)
+        t.join();
+    LOG(INFO) << "analyzed " << positions << " positions";
+    return 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <iostream>
+
+#include "network.h"
+
+/*
+input holds one position per line as moves played from empty board, e.g. "3,4 4,4 3,5"
+each move is "row,col", separated by blanks; empty lines are skipped
+output is one json object per position, in input order
+input is consumed a group of ANALYZE_BATCH_SIZE positions at a time, so output starts before input ends
+*/
+int analyze(long long verno, std::istream &in, std::ostream &out, int itermax, int top_n, int thread_num,
+    bool ensemble = false);
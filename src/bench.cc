@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <regex>
+#include <sstream>
+
+#include "mcts.h"
+#include "threat.h"
+
+const char *bench_usage =
+    "usage: gomoku-bench [baseline] [tolerance]\n"
+    "   [baseline]  json file produced by a previous run, compare median time against it\n"
+    "   [tolerance] allowed slowdown ratio before a case counts as regression\n"
+    "               if not given, default to '0.1'\n\n"
+    "results are printed to stdout as json, exit code is non-zero if any case regressed\n\n";
+
+constexpr int BENCH_TRIAL_NUM = 15;
+
+struct BenchResult {
+    std::string name;
+    long long ops_per_trial;
+    double median_ns;
+    double min_ns;
+    double max_ns;
+};
+
+// runs fn iter_num times per trial, reports nanoseconds per op with ops_per_iter ops in each call
+template<typename Fn>
+BenchResult run_bench(const std::string &name, int iter_num, int ops_per_iter, Fn fn) {
+    for (int i = 0; i < iter_num; ++i)
+        fn();
+    std::vector<double> samples;
+    for (int t = 0; t < BENCH_TRIAL_NUM; ++t) {
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < iter_num; ++i)
+            fn();
+        auto end = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(end - begin).count();
+        samples.push_back(ns / (double(iter_num) * ops_per_iter));
+    }
+    std::sort(samples.begin(), samples.end());
+    std::cerr << std::left << std::setw(32) << name << std::right << std::setw(14)
+        << std::fixed << std::setprecision(1) << samples[samples.size() / 2] << " ns/op" << std::endl;
+    return BenchResult{ name, (long long)iter_num * ops_per_iter,
+        samples[samples.size() / 2], samples.front(), samples.back() };
+}
+
+State make_midgame_state(int moves) {
+    State state;
+    for (int i = 0; i < moves && !state.over(); ++i)
+        state.next(state.get_options()[0]);
+    return state;
+}
+
+// random playout stopped at given number of empty squares, retried until nobody has won by then
+State make_endgame_state(int empties) {
+    Xoshiro256 rng(1);
+    for (;;) {
+        State state;
+        while (!state.over() && state.get_options().size() > empties)
+            state.next(state.get_options()[rng.below(int(state.get_options().size()))]);
+        if (!state.over())
+            return state;
+    }
+}
+
+std::vector<BenchResult> bench_game() {
+    std::vector<BenchResult> results;
+    State midgame = make_midgame_state(BOARD_SIZE / 3);
+    Board board;
+    std::vector<Move> stones;
+    for (int z = 0; z < BOARD_SIZE; z += 2) {
+        board.put(Move(z), z % 4 == 0 ? Color::Black : Color::White);
+        stones.push_back(Move(z));
+    }
+    volatile bool sink = false;
+    results.push_back(run_bench("Board::win_from", 2000, int(stones.size()), [&] {
+        for (auto mv : stones)
+            sink = board.win_from(mv);
+    }));
+    State empty;
+    results.push_back(run_bench("State::next", 2000, BOARD_SIZE / 2, [&] {
+        State state(empty);
+        for (int i = 0; i < BOARD_SIZE / 2 && !state.over(); ++i)
+            state.next(state.get_options()[0]);
+    }));
+    results.push_back(run_bench("State::next_rand_till_end", 2000, 1, [&] {
+        State state(midgame);
+        sink = state.next_rand_till_end() == Color::Empty;
+    }));
+    float features[INPUT_FEATURE_NUM * BOARD_SIZE];
+    results.push_back(run_bench("State::write_features", 20000, 1, [&] {
+        midgame.write_features(features);
+        sink = features[0] > 0.5f;
+    }));
+    results.push_back(run_bench("VCFSolver::solve", 2000, 1, [&] {
+        sink = VCFSolver(midgame.get_board()).solve(midgame.current()).z() == NO_MOVE_YET;
+    }));
+    State endgame = make_endgame_state(ENDGAME_EMPTY_THRESHOLD);
+    results.push_back(run_bench("EndgameSolver::solve", 20, 1, [&] {
+        EndgameSolver solver;
+        int value;
+        std::vector<Move> best_moves;
+        sink = solver.solve(endgame, value, best_moves) && value > 0;
+    }));
+    (void)sink;
+    return results;
+}
+
+std::vector<BenchResult> bench_mcts() {
+    std::vector<BenchResult> results;
+    State empty;
+    MCTSPurePlayer player(TEST_PURE_ITERMAX, C_PUCT);
+    results.push_back(run_bench("MCTSPurePlayer::play", 3, 1, [&] {
+        player.reset();
+        player.play(empty);
+    }));
+    MCTSNode root(nullptr, 1.0f);
+    std::vector<std::pair<Move, float>> move_priors;
+    for (int z = 0; z < BOARD_SIZE; ++z)
+        move_priors.push_back(std::make_pair(Move(z), 1.0f / BOARD_SIZE));
+    root.expand(move_priors);
+    for (int i = 0; i < 4 * BOARD_SIZE; ++i) {
+        auto picked = root.select(C_PUCT);
+        picked.second->update_recursive(i % 3 == 0 ? 1.0f : -1.0f);
+    }
+    volatile int sink = 0;
+    float noise[BOARD_SIZE];
+    results.push_back(run_bench("sample_dirichlet", 2000, BOARD_SIZE, [&] {
+        sample_dirichlet(DIRICHLET_ALPHA, BOARD_SIZE, noise);
+        sink = noise[0] > 0.5f;
+    }));
+    results.push_back(run_bench("MCTSNode::select", 20000, 1, [&] {
+        sink = root.select(C_PUCT).first.z();
+    }));
+    (void)sink;
+    return results;
+}
+
+std::vector<BenchResult> bench_network() {
+    std::vector<BenchResult> results;
+    auto net = std::make_shared<FIRNet>(0);
+    State midgame = make_midgame_state(10);
+    results.push_back(run_bench("FIRNet::forward", 200, 1, [&] {
+        float value[1];
+        std::vector<std::pair<Move, float>> move_priors;
+        net->forward(midgame, value, move_priors);
+    }));
+    DataSet dataset;
+    for (int i = 0; i < BUFFER_SIZE; ++i) {
+        State state = make_midgame_state(i % (BOARD_SIZE / 2));
+        SampleData sample;
+        state.fill_feature_array(sample.data);
+        sample.p_label[i % BOARD_SIZE] = 1.0f;
+        sample.v_label[0] = i % 2 == 0 ? 1.0f : -1.0f;
+        dataset.push_back(&sample);
+    }
+    auto batch = new MiniBatch();
+    results.push_back(run_bench("DataSet::make_mini_batch", 20, BATCH_SIZE, [&] {
+        dataset.make_mini_batch(batch);
+    }));
+    results.push_back(run_bench("FIRNet::train_step", 5, BATCH_SIZE, [&] {
+        net->train_step(batch);
+    }));
+    delete batch;
+    return results;
+}
+
+std::map<std::string, double> load_baseline(const std::string &file_name) {
+    std::map<std::string, double> baseline;
+    std::ifstream in(file_name);
+    std::stringstream content;
+    content << in.rdbuf();
+    std::string text = content.str();
+    std::regex entry("\"name\":\\s*\"([^\"]+)\"[^}]*?\"median_ns\":\\s*([0-9.eE+-]+)");
+    for (std::sregex_iterator it(text.begin(), text.end(), entry), end; it != end; ++it)
+        baseline[(*it)[1].str()] = std::stod((*it)[2].str());
+    return baseline;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 3) {
+        std::cout << bench_usage;
+        return -1;
+    }
+    std::map<std::string, double> baseline;
+    if (argc >= 2) {
+        baseline = load_baseline(argv[1]);
+        if (baseline.empty()) {
+            std::cout << "no benchmark found in baseline file: " << argv[1] << std::endl;
+            return -1;
+        }
+    }
+    double tolerance = argc == 3 ? std::atof(argv[2]) : 0.1;
+
+    std::vector<BenchResult> results;
+    for (auto group : { bench_game, bench_mcts, bench_network }) {
+        auto part = group();
+        results.insert(results.end(), part.begin(), part.end());
+    }
+
+    bool regressed = false;
+    std::cout << "{\n  \"game_mode\": \"" << BOARD_MAX_ROW << "x" << BOARD_MAX_COL << "by" << FIVE_IN_ROW
+        << "\",\n  \"trials\": " << BENCH_TRIAL_NUM << ",\n  \"results\": [\n";
+    std::cout << std::fixed << std::setprecision(1);
+    for (int i = 0; i < results.size(); ++i) {
+        const auto &r = results[i];
+        std::cout << "    {\"name\": \"" << r.name << "\", \"ops_per_trial\": " << r.ops_per_trial
+            << ", \"median_ns\": " << r.median_ns << ", \"min_ns\": " << r.min_ns
+            << ", \"max_ns\": " << r.max_ns;
+        auto base = baseline.find(r.name);
+        if (base != baseline.end()) {
+            double ratio = r.median_ns / base->second;
+            bool slow = ratio > 1.0 + tolerance;
+            regressed = regressed || slow;
+            std::cout << ", \"baseline_ns\": " << base->second << std::setprecision(3)
+                << ", \"ratio\": " << ratio << std::setprecision(1)
+                << ", \"regressed\": " << (slow ? "true" : "false");
+        }
+        std::cout << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    std::cout << "  ],\n  \"regressed\": " << (regressed ? "true" : "false") << "\n}" << std::endl;
+    return regressed ? 1 : 0;
+}
@@ -36,7 +36,7 @@ void Board::push_valid(std::vector<Move> &set) const {
         if (get(Move(i)) == Color::Empty)
             set.push_back(Move(i));
 
-    std::shuffle(set.begin(), set.end(), global_random_engine);
+    std::shuffle(set.begin(), set.end(), thread_random_engine());
 }
 
 bool Board::win_from(Move mv) const {
@@ -84,45 +84,75 @@ Color State::current() const {
     return ~board.get(last);
 }
 
-void State::fill_feature_array(float data[INPUT_FEATURE_NUM * BOARD_SIZE]) const {
-    if (last.z() == NO_MOVE_YET) {
-        if (INPUT_FEATURE_NUM > 3) {
-            for (int r = 0; r < BOARD_MAX_ROW; ++r)
-                for (int c = 0; c < BOARD_MAX_COL; ++c)
-                    data[3 * BOARD_SIZE + r * BOARD_MAX_COL + c] = 1.0f;
-        }
-        return;
-    }
+void State::write_features(float data[INPUT_FEATURE_NUM * BOARD_SIZE], const int *index_map) const {
     auto own_side = current();
-    auto enemy_side = ~own_side;
-    float first = first_hand() ? 1.0f : 0.0f;
-    for (int r = 0; r < BOARD_MAX_ROW; ++r) {
-        for (int c = 0; c < BOARD_MAX_COL; ++c) {
-            auto side = board.get(Move(r, c));
-            if (side == own_side)
-                data[r * BOARD_MAX_COL + c] = 1.0f;
-            else if (side == enemy_side)
-                data[BOARD_SIZE + r * BOARD_MAX_COL + c] = 1.0f;
-            if (INPUT_FEATURE_NUM > 3)
-                data[3 * BOARD_SIZE + r * BOARD_MAX_COL + c] = first;
+    const float *own = stones[own_side == Color::Black ? 0 : 1];
+    const float *enemy = stones[own_side == Color::Black ? 1 : 0];
+    if (index_map == nullptr) {
+        std::copy(own, own + BOARD_SIZE, data);
+        std::copy(enemy, enemy + BOARD_SIZE, data + BOARD_SIZE);
+    }
+    else {
+        for (int z = 0; z < BOARD_SIZE; ++z) {
+            data[index_map[z]] = own[z];
+            data[BOARD_SIZE + index_map[z]] = enemy[z];
         }
     }
-    if (INPUT_FEATURE_NUM > 2)
-        data[2 * BOARD_SIZE  + last.r() * BOARD_MAX_COL + last.c()] = 1.0f;
+    if (INPUT_FEATURE_NUM > 2) {
+        std::fill(data + 2 * BOARD_SIZE, data + 3 * BOARD_SIZE, 0.0f);
+        if (last.z() != NO_MOVE_YET)
+            data[2 * BOARD_SIZE + (index_map == nullptr ? last.z() : index_map[last.z()])] = 1.0f;
+    }
+    if (INPUT_FEATURE_NUM > 3)
+        std::fill(data + 3 * BOARD_SIZE, data + 4 * BOARD_SIZE, first_hand() ? 1.0f : 0.0f);
 }
 
 void State::next(Move mv) {
     assert(valid(mv));
     Color side = current();
     board.put(mv, side);
+    stones[side == Color::Black ? 0 : 1][mv.z()] = 1.0f;
     if (board.win_from(mv)) winner = side;
     last = mv;
     opts.erase(std::find(opts.cbegin(), opts.cend(), mv));
+    if (CANDIDATE_DISTANCE > 0)
+        update_candidates(mv);
+}
+
+void State::update_candidates(Move mv) {
+    if (near[mv.z()]) {
+        // order of candidates does not matter, fill the hole with last one
+        auto iter = std::find(cands.begin(), cands.end(), mv);
+        *iter = cands.back();
+        cands.pop_back();
+    }
+    near[mv.z()] = true;
+    int row_end = std::min(mv.r() + CANDIDATE_DISTANCE, BOARD_MAX_ROW - 1);
+    int col_end = std::min(mv.c() + CANDIDATE_DISTANCE, BOARD_MAX_COL - 1);
+    for (int r = std::max(mv.r() - CANDIDATE_DISTANCE, 0); r <= row_end; ++r) {
+        for (int c = std::max(mv.c() - CANDIDATE_DISTANCE, 0); c <= col_end; ++c) {
+            int z = r * BOARD_MAX_COL + c;
+            if (!near[z]) {
+                near[z] = true;
+                cands.push_back(Move(z));
+            }
+        }
+    }
 }
 
 Color State::next_rand_till_end() {
-    while (!over())
-        next(opts[0]);
+    if (CANDIDATE_DISTANCE == 0) {
+        // opts is shuffled, playing it in order is already a random playout
+        while (!over())
+            next(opts[0]);
+        return winner;
+    }
+    auto &rng = thread_random_engine();
+    while (!over()) {
+        const auto &moves = get_candidates();
+        Move mv = moves[rng.below(int(moves.size()))];
+        next(mv);
+    }
     return winner;
 }
 
@@ -5,7 +5,7 @@
 #include <iostream>
 #include <vector>
 
-#include "vars.h"
+#include "random.h"
 
 /*
 3 * 3 board looks like:
@@ -56,15 +56,24 @@ class State {
     Move last;
     Color winner;
     std::vector<Move> opts;
+    std::vector<Move> cands; // empty cells within CANDIDATE_DISTANCE of a stone, kept up to date by next
+    bool near[BOARD_SIZE]; // cell is a candidate or occupied
+    float stones[2][BOARD_SIZE]; // black and white stone planes, kept up to date by next
+    void update_candidates(Move mv);
 public:
-    State() : last(NO_MOVE_YET), winner(Color::Empty) { board.push_valid(opts); }
+    State() : last(NO_MOVE_YET), winner(Color::Empty), near{ false }, stones{ { 0.0f } } { board.push_valid(opts); }
     State(const State &state) = default;
+    const Board &get_board() const { return board; }
     Move get_last() const { return last; }
     Color get_winner() const { return winner; }
     Color current() const;
     bool first_hand() const { return current() == Color::Black; }
-    void fill_feature_array(float data[INPUT_FEATURE_NUM * BOARD_SIZE]) const;
+    void fill_feature_array(float data[INPUT_FEATURE_NUM * BOARD_SIZE]) const { write_features(data); }
+    // overwrites every plane of data, cell z goes to index_map[z] if given
+    void write_features(float data[INPUT_FEATURE_NUM * BOARD_SIZE], const int *index_map = nullptr) const;
     const std::vector<Move> &get_options() const { assert(!over()); return opts; };
+    // moves worth searching, every empty cell while no candidate exists
+    const std::vector<Move> &get_candidates() const { assert(!over()); return cands.empty() ? opts : cands; }
     bool valid(Move mv) const { return std::find(opts.cbegin(), opts.cend(), mv) != opts.end(); }
     bool over() const { return winner != Color::Empty || opts.size() == 0; }
     void next(Move mv);
@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+#include "ladder.h"
+#include "mcts.h"
+
+static_assert(LADDER_PAIR_GAMES % 2 == 0, "ladder plays every opening twice with colors swapped");
+
+bool parse_opening(const std::string &text, std::vector<int> &opening) {
+    opening.clear();
+    if (text == "-")
+        return true;
+    std::istringstream in(text);
+    std::string cell;
+    while (std::getline(in, cell, ',')) {
+        char *end = nullptr;
+        long z = std::strtol(cell.c_str(), &end, 10);
+        if (cell.empty() || *end != '\0' || z < 0 || z >= BOARD_SIZE)
+            return false;
+        opening.push_back(int(z));
+    }
+    return true;
+}
+
+std::string format_opening(const std::vector<int> &opening) {
+    if (opening.empty())
+        return "-";
+    std::ostringstream out;
+    for (int i = 0; i < opening.size(); ++i)
+        out << (i > 0 ? "," : "") << opening[i];
+    return out.str();
+}
+
+bool read_ladder_results(const std::string &file_name, std::vector<LadderGame> &games) {
+    std::ifstream in(file_name);
+    if (!in)
+        return false;
+    std::string line, opening;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        LadderGame game;
+        if (!(fields >> game.black >> game.white >> game.itermax >> game.result >> opening)
+                || game.result < -1 || game.result > 1 || !parse_opening(opening, game.opening))
+            continue;
+        games.push_back(game);
+    }
+    return true;
+}
+
+std::vector<LadderRating> fit_ladder(const std::vector<long long> &vernos, int itermax,
+        const std::vector<LadderGame> &games) {
+    const int n = vernos.size();
+    std::map<long long, int> index;
+    for (int i = 0; i < n; ++i)
+        index[vernos[i]] = i;
+    std::vector<LadderRating> ratings(n);
+    for (int i = 0; i < n; ++i)
+        ratings[i] = { vernos[i], 0.0, 0.0, 0, 0.0 };
+    // (i, j) with i < j maps to games played and points scored by i, draws worth half
+    std::map<std::pair<int, int>, std::pair<double, double>> pairs;
+    for (const auto &game : games) {
+        auto black = index.find(game.black), white = index.find(game.white);
+        if (game.itermax != itermax || black == index.end() || white == index.end() || black == white)
+            continue;
+        int i = std::min(black->second, white->second), j = std::max(black->second, white->second);
+        double black_points = 0.5 + 0.5 * game.result;
+        auto &entry = pairs[std::make_pair(i, j)];
+        entry.first += 1.0;
+        entry.second += i == black->second ? black_points : 1.0 - black_points;
+        ratings[black->second].games += 1;
+        ratings[black->second].score += black_points;
+        ratings[white->second].games += 1;
+        ratings[white->second].score += 1.0 - black_points;
+    }
+    for (auto &rating : ratings)
+        rating.score = rating.games > 0 ? rating.score / rating.games : 0.0;
+    if (n < 2 || pairs.empty())
+        return ratings;
+
+    std::vector<double> wins(n, 0.0), gamma(n, 1.0), denom(n);
+    for (auto &entry : pairs) {
+        entry.second.first += 1.0;
+        entry.second.second += 0.5;
+        wins[entry.first.first] += entry.second.second;
+        wins[entry.first.second] += entry.second.first - entry.second.second;
+    }
+    for (int iter = 0; iter < 100000; ++iter) {
+        std::fill(denom.begin(), denom.end(), 0.0);
+        for (const auto &entry : pairs) {
+            int i = entry.first.first, j = entry.first.second;
+            double d = entry.second.first / (gamma[i] + gamma[j]);
+            denom[i] += d;
+            denom[j] += d;
+        }
+        double change = 0.0;
+        for (int i = 0; i < n; ++i) {
+            if (denom[i] <= 0.0)
+                continue;
+            double next = wins[i] / denom[i];
+            change = std::max(change, std::fabs(std::log(next / gamma[i])));
+            gamma[i] = next;
+        }
+        double anchor = gamma[0];
+        for (auto &g : gamma)
+            g /= anchor;
+        if (change < 1e-10)
+            break;
+    }
+
+    // fisher information over all but anchor, banded as pairings only join nets close in verno order
+    const int m = n - 1;
+    int band = 0;
+    for (const auto &entry : pairs)
+        band = std::max(band, entry.first.second - entry.first.first);
+    std::vector<double> chol(size_t(m) * (band + 1), 0.0);
+    auto at = [&](int i, int j) -> double & { return chol[size_t(i) * (band + 1) + (i - j)]; };
+    for (const auto &entry : pairs) {
+        int i = entry.first.first, j = entry.first.second;
+        double p = gamma[i] / (gamma[i] + gamma[j]);
+        double info = entry.second.first * p * (1.0 - p);
+        if (i > 0)
+            at(i - 1, i - 1) += info;
+        at(j - 1, j - 1) += info;
+        if (i > 0)
+            at(j - 1, i - 1) -= info;
+    }
+    for (int i = 0; i < m; ++i) {
+        for (int j = std::max(0, i - band); j <= i; ++j) {
+            double s = at(i, j);
+            for (int k = std::max(0, i - band); k < j; ++k)
+                s -= at(i, k) * at(j, k);
+            if (i == j)
+                at(i, i) = std::sqrt(std::max(s, 1e-12));
+            else
+                at(i, j) = s / at(j, j);
+        }
+    }
+    const double elo_scale = 400.0 / std::log(10.0);
+    std::vector<double> x(m);
+    for (int t = 0; t < m; ++t) {
+        std::fill(x.begin(), x.end(), 0.0);
+        for (int i = t; i < m; ++i) {
+            double s = i == t ? 1.0 : 0.0;
+            for (int k = std::max(t, i - band); k < i; ++k)
+                s -= at(i, k) * x[k];
+            x[i] = s / at(i, i);
+        }
+        for (int i = m - 1; i >= t; --i) {
+            double s = x[i];
+            for (int k = i + 1; k <= std::min(m - 1, i + band); ++k)
+                s -= at(k, i) * x[k];
+            x[i] = s / at(i, i);
+        }
+        ratings[t + 1].ci = 1.96 * std::sqrt(std::max(x[t], 0.0)) * elo_scale;
+    }
+    for (int i = 0; i < n; ++i)
+        ratings[i].elo = std::log(gamma[i]) * elo_scale;
+    return ratings;
+}
+
+std::vector<int> random_opening() {
+    auto &rng = thread_random_engine();
+    State state;
+    std::vector<int> opening;
+    for (int i = 0; i < LADDER_OPENING_MOVES && !state.over(); ++i) {
+        const auto &cands = state.get_candidates();
+        Move mv = cands[rng.below(cands.size())];
+        opening.push_back(mv.z());
+        state.next(mv);
+    }
+    return opening;
+}
+
+int play_opening(Player &black, Player &white, const std::vector<int> &opening) {
+    State game;
+    for (int z : opening)
+        game.next(Move(z));
+    black.reset();
+    white.reset();
+    while (!game.over()) {
+        Player &player = game.current() == Color::Black ? black : white;
+        game.next(player.play(game));
+    }
+    return game.get_winner() == Color::Black ? 1 : game.get_winner() == Color::White ? -1 : 0;
+}
+
+struct LadderPairing {
+    long long a;
+    long long b;
+    int played = 0;
+    long long last_black = 0;
+    std::vector<int> last_opening;
+};
+
+int ladder(std::vector<long long> vernos, const std::string &results_file, int itermax, int thread_num) {
+    std::sort(vernos.begin(), vernos.end());
+    vernos.erase(std::unique(vernos.begin(), vernos.end()), vernos.end());
+    std::vector<LadderGame> games;
+    if (!read_ladder_results(results_file, games))
+        LOG(INFO) << "no results in " << results_file << ", starting a new one";
+
+    std::vector<LadderPairing> jobs;
+    for (int i = 0; i < vernos.size(); ++i) {
+        for (int d = 1; d <= LADDER_NEIGHBOR_NUM && i + d < vernos.size(); ++d) {
+            LadderPairing job;
+            job.a = vernos[i];
+            job.b = vernos[i + d];
+            for (const auto &game : games) {
+                if (game.itermax == itermax && std::min(game.black, game.white) == job.a
+                        && std::max(game.black, game.white) == job.b) {
+                    ++job.played;
+                    job.last_black = game.black;
+                    job.last_opening = game.opening;
+                }
+            }
+            if (job.played < LADDER_PAIR_GAMES)
+                jobs.push_back(job);
+        }
+    }
+    int missing = 0;
+    for (const auto &job : jobs)
+        missing += LADDER_PAIR_GAMES - job.played;
+    LOG(INFO) << "ladder of " << vernos.size() << " nets with itermax=" << itermax << ", cached games="
+              << games.size() << ", missing games=" << missing << ", threads=" << thread_num;
+
+    std::ofstream out(results_file, std::ios::app);
+    if (missing > 0 && !out) {
+        std::cout << "failed to open " << results_file << std::endl;
+        return -1;
+    }
+    std::atomic<int> next_job(0);
+    std::mutex out_mtx;
+    int finished = 0;
+    auto work = [&] {
+        for (;;) {
+            int j = next_job++;
+            if (j >= jobs.size())
+                break;
+            const auto &job = jobs[j];
+            MCTSDeepPlayer pa(std::make_shared<FIRNet>(job.a, true), itermax, C_PUCT);
+            MCTSDeepPlayer pb(std::make_shared<FIRNet>(job.b, true), itermax, C_PUCT);
+            LadderGame game = { job.a, job.b, itermax, 0, job.last_opening };
+            game.black = job.last_black;
+            // every opening is played twice with colors swapped, a run cut between the two finishes the pair
+            for (int k = job.played; k < LADDER_PAIR_GAMES; ++k) {
+                if (k % 2 == 0) {
+                    game.opening = random_opening();
+                    game.black = job.a;
+                }
+                else {
+                    game.black = game.black == job.a ? job.b : job.a;
+                }
+                game.white = game.black == job.a ? job.b : job.a;
+                game.result = game.black == job.a ? play_opening(pa, pb, game.opening)
+                                                  : play_opening(pb, pa, game.opening);
+                std::lock_guard<std::mutex> lock(out_mtx);
+                out << game.black << " " << game.white << " " << game.itermax << " " << game.result
+                    << " " << format_opening(game.opening) << "\n";
+                out.flush();
+                games.push_back(game);
+                if (++finished % 10 == 0 || finished == missing)
+                    LOG(INFO) << "ladder played " << finished << "/" << missing << " games";
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < thread_num; ++i)
+        threads.emplace_back(work);
+    for (auto &t : threads)
+        t.join();
+
+    auto ratings = fit_ladder(vernos, itermax, games);
+    std::cout << std::fixed << std::setprecision(1)
+              << std::setw(12) << "verno" << std::setw(10) << "elo" << std::setw(10) << "ci95"
+              << std::setw(8) << "games" << std::setw(8) << "score" << std::endl;
+    for (const auto &rating : ratings) {
+        std::cout << std::setw(12) << rating.verno << std::setw(10) << rating.elo
+                  << std::setw(10) << rating.ci << std::setw(8) << rating.games
+                  << std::setw(8) << std::setprecision(3) << rating.score << std::setprecision(1) << std::endl;
+    }
+    return 0;
+}
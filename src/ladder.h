@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/*
+results file holds one finished game per line, appended as soon as the game ends:
+  <black verno> <white verno> <itermax> <result> <opening>
+result is 1 if black won, -1 if white won, 0 for draw
+opening is the comma separated cells of the random moves played before the nets took over, '-' if none
+games of other itermax or of nets outside the ladder are kept but ignored
+*/
+struct LadderGame {
+    long long black;
+    long long white;
+    int itermax;
+    int result;
+    std::vector<int> opening;
+};
+
+struct LadderRating {
+    long long verno;
+    double elo;
+    double ci; // half width of 95% confidence interval
+    int games;
+    double score;
+};
+
+bool read_ladder_results(const std::string &file_name, std::vector<LadderGame> &games);
+// bradley-terry fit by minorization-maximization, every pairing adds one virtual draw to keep ratings finite
+// elo is relative to first verno, interval from inverse fisher information
+std::vector<LadderRating> fit_ladder(const std::vector<long long> &vernos, int itermax,
+    const std::vector<LadderGame> &games);
+// plays missing games of every pairing between neighbours in verno order, then prints fitted ratings
+int ladder(std::vector<long long> vernos, const std::string &results_file, int itermax, int thread_num);
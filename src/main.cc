@@ -1,6 +1,12 @@
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <thread>
 
+#include "analyze.h"
+#include "ladder.h"
 #include "mcts.h"
+#include "protocol.h"
 #include "train.h"
 
 #define EXIT_WITH_USAGE(usage)  { std::cout << usage; return -1; }
@@ -11,7 +17,14 @@ const char *usage =
     "   config     Print global configure\n"
     "   train      Train model from scatch or parameter file\n"
     "   play       Play with trained model\n"
-    "   benchmark  Benchmark between two mcts deep players\n\n";
+    "   benchmark  Benchmark between two mcts deep players\n"
+    "   convert    Convert parameter file into memory-mappable flat format\n"
+    "   trainer    Train model with selfplay games streamed from remote workers\n"
+    "   worker     Run selfplay for a remote trainer\n"
+    "   protocol   Run as Piskvork/Gomocup engine on stdin and stdout\n"
+    "   analyze    Search many positions and print top moves as json lines\n"
+    "   train-offline  Train model on recorded selfplay games without selfplay\n"
+    "   ladder     Rate many checkpoints by games between neighbours, cached in a results file\n\n";
 
 const char *train_usage =
     "usage: gomoku train <net>\n"
@@ -19,12 +32,14 @@ const char *train_usage =
     "              if equal to zero, train from scratch; otherwise continue to train model from last check-point\n\n";
 
 const char *play_usage =
-    "usage: gomoku play <color> <net> [itermax]\n"
+    "usage: gomoku play <color> <net> [itermax] [ensemble]\n"
     "   <color>    '0' if human take first hand, '1' otherwise\n"
     "              specially '-1' means let computer selfplay\n"
     "   <net>      verno of network(must > 0), which is the suffix of parameter file basename\n"
     "   [itermax]  itermax for mcts deep player\n"
-    "              if not given, default from global configure\n\n";
+    "              if not given, default from global configure\n"
+    "   [ensemble] '1' if average network output over all 8 board symmetries, '0' otherwise\n"
+    "              if not given, default to '0'\n\n";
 
 const char *benchmark_usage =
     "usage: gomoku benchmark <net1> <net2> [itermax]\n"
@@ -33,8 +48,56 @@ const char *benchmark_usage =
     "   [itermax]  itermax for mcts deep player\n"
     "              if not given, default from global configure\n\n";
 
-std::random_device global_random_device;
-std::mt19937 global_random_engine(global_random_device());
+const char *convert_usage =
+    "usage: gomoku convert <net>\n"
+    "   <net>      verno of network(must > 0), which is the suffix of parameter file basename\n"
+    "              output has the same basename with '.flat' suffix, preferred by play and benchmark\n\n";
+
+const char *trainer_usage =
+    "usage: gomoku trainer <net> <port> [threads]\n"
+    "   <net>      verno of network(must >= 0), which is the suffix of parameter file basename\n"
+    "              if equal to zero, train from scratch; otherwise continue to train model from last check-point\n"
+    "   <port>     tcp port to listen on for workers\n"
+    "   [threads]  number of local selfplay threads\n"
+    "              if not given, default to '0'\n\n";
+
+const char *worker_usage =
+    "usage: gomoku worker <host> <port>\n"
+    "   <host>     address of the trainer\n"
+    "   <port>     tcp port the trainer listens on\n\n";
+
+const char *protocol_usage =
+    "usage: gomoku protocol <net> [itermax]\n"
+    "   <net>      verno of network(must > 0), which is the suffix of parameter file basename\n"
+    "   [itermax]  upper bound of itermax for mcts deep player, search stops earlier on time or memory limits\n"
+    "              if not given, search is only bounded by limits sent from manager\n\n";
+
+const char *analyze_usage =
+    "usage: gomoku analyze <net> <input> [itermax] [topn] [threads] [ensemble]\n"
+    "   <net>      verno of network(must > 0), which is the suffix of parameter file basename\n"
+    "   <input>    file with one position per line as moves like '3,4 4,4 3,5', '-' to read stdin\n"
+    "   [itermax]  itermax for mcts deep player\n"
+    "              if not given, default from global configure\n"
+    "   [topn]     number of best moves reported per position\n"
+    "              if not given, default from global configure\n"
+    "   [threads]  number of search threads, each with its own network\n"
+    "              if not given, default to number of cpu cores\n"
+    "   [ensemble] '1' if average network output over all 8 board symmetries, '0' otherwise\n"
+    "              if not given, default to '0'\n\n";
+
+const char *train_offline_usage =
+    "usage: gomoku train-offline <net> <passes> <segment>...\n"
+    "   <net>      verno of network(must >= 0), which is the suffix of parameter file basename\n"
+    "              if equal to zero, train from scratch; otherwise continue to train model from last check-point\n"
+    "   <passes>   times to go over all segments\n"
+    "   <segment>  game record files written during train or trainer, read in given order\n\n";
+
+const char *ladder_usage =
+    "usage: gomoku ladder <results> <itermax> <net>...\n"
+    "   <results>  file of finished games, created if missing and appended to, games found there are not replayed\n"
+    "   <itermax>  itermax for mcts deep players, ratings only use games of this itermax\n"
+    "   <net>      verno of network(must > 0) or its parameter file name in working directory, see 'config'\n"
+    "              each one plays the next newer ones, games run on one thread per cpu core\n\n";
 
 int main(int argc, char *argv[]) {
     if (argc > 1 && strcmp(argv[1], "config") == 0) {
@@ -55,13 +118,15 @@ int main(int argc, char *argv[]) {
     }
 
     if (argc > 1 && strcmp(argv[1], "play") == 0) {
-        if (argc == 4 || argc == 5) {
+        if (argc >= 4 && argc <= 6) {
             int itermax = TRAIN_DEEP_ITERMAX;
-            if (argc == 5)
+            if (argc >= 5)
                 itermax = std::atoi(argv[4]);
-            std::cout << "mcts_itermax=" << itermax << std::endl;
+            bool ensemble = argc == 6 && strcmp(argv[5], "1") == 0;
+            std::cout << "mcts_itermax=" << itermax << ", ensemble=" << ensemble << std::endl;
             long long verno = std::atoi(argv[3]);
-            auto net = std::make_shared<FIRNet>(verno);
+            auto net = std::make_shared<FIRNet>(verno, true);
+            net->set_ensemble(ensemble);
             auto p1 = MCTSDeepPlayer(net, itermax, C_PUCT);
             if (strcmp(argv[2], "0") == 0) {
                 auto p0 = HumanPlayer("human");
@@ -87,9 +152,9 @@ int main(int argc, char *argv[]) {
                 itermax = std::atoi(argv[4]);
             std::cout << "mcts_itermax=" << itermax << std::endl;
             long long verno1 = std::atoi(argv[2]);
-            auto net1 = std::make_shared<FIRNet>(verno1);
+            auto net1 = std::make_shared<FIRNet>(verno1, true);
             long long verno2 = std::atoi(argv[3]);
-            auto net2 = std::make_shared<FIRNet>(verno2);
+            auto net2 = std::make_shared<FIRNet>(verno2, true);
             auto p1 = MCTSDeepPlayer(net1, itermax, C_PUCT);
             auto p2 = MCTSDeepPlayer(net2, itermax, C_PUCT);
             benchmark(p1, p2, 10, false);
@@ -98,5 +163,126 @@ int main(int argc, char *argv[]) {
         EXIT_WITH_USAGE(benchmark_usage);
     }
 
+    if (argc > 1 && strcmp(argv[1], "convert") == 0) {
+        if (argc == 3) {
+            long long verno = std::atoi(argv[2]);
+            if (verno <= 0)
+                EXIT_WITH_USAGE(convert_usage);
+            FIRNet net(verno);
+            net.save_flat_param();
+            return 0;
+        }
+        EXIT_WITH_USAGE(convert_usage);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "trainer") == 0) {
+        if (argc == 4 || argc == 5) {
+            long long verno = std::atoi(argv[2]);
+            int port = std::atoi(argv[3]);
+            int threads = argc == 5 ? std::atoi(argv[4]) : 0;
+            if (port <= 0 || threads < 0)
+                EXIT_WITH_USAGE(trainer_usage);
+            std::shared_ptr<FIRNet> net = std::make_shared<FIRNet>(verno);
+            show_global_cfg(std::cout);
+            net->show_param(std::cout);
+            train(net, threads, port);
+            return 0;
+        }
+        EXIT_WITH_USAGE(trainer_usage);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "worker") == 0) {
+        if (argc == 4) {
+            int port = std::atoi(argv[3]);
+            if (port <= 0)
+                EXIT_WITH_USAGE(worker_usage);
+            return selfplay_worker(argv[2], port) ? 0 : -1;
+        }
+        EXIT_WITH_USAGE(worker_usage);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "protocol") == 0) {
+        if (argc == 3 || argc == 4) {
+            long long verno = std::atoi(argv[2]);
+            int itermax = argc == 4 ? std::atoi(argv[3]) : std::numeric_limits<int>::max();
+            if (verno <= 0 || itermax <= 0)
+                EXIT_WITH_USAGE(protocol_usage);
+            // stdout belongs to protocol, any other output goes to stderr
+            std::ostream protocol_out(std::cout.rdbuf());
+            std::cout.rdbuf(std::cerr.rdbuf());
+            auto net = std::make_shared<FIRNet>(verno, true);
+            return run_protocol(net, itermax, std::cin, protocol_out);
+        }
+        EXIT_WITH_USAGE(protocol_usage);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "analyze") == 0) {
+        if (argc >= 4 && argc <= 8) {
+            long long verno = std::atoi(argv[2]);
+            int itermax = argc >= 5 ? std::atoi(argv[4]) : TRAIN_DEEP_ITERMAX;
+            int top_n = argc >= 6 ? std::atoi(argv[5]) : ANALYZE_TOP_N;
+            int threads = argc >= 7 ? std::atoi(argv[6]) : int(std::thread::hardware_concurrency());
+            bool ensemble = argc == 8 && strcmp(argv[7], "1") == 0;
+            if (threads <= 0)
+                threads = 1;
+            if (verno <= 0 || itermax <= 0 || top_n <= 0)
+                EXIT_WITH_USAGE(analyze_usage);
+            std::ifstream file;
+            if (strcmp(argv[3], "-") != 0) {
+                file.open(argv[3]);
+                if (!file) {
+                    std::cout << "failed to open " << argv[3] << std::endl;
+                    return -1;
+                }
+            }
+            std::ostream result_out(std::cout.rdbuf());
+            std::cout.rdbuf(std::cerr.rdbuf());
+            return analyze(verno, file.is_open() ? file : std::cin, result_out, itermax, top_n, threads, ensemble);
+        }
+        EXIT_WITH_USAGE(analyze_usage);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "train-offline") == 0) {
+        if (argc >= 5) {
+            long long verno = std::atoi(argv[2]);
+            int passes = std::atoi(argv[3]);
+            if (verno < 0 || passes <= 0)
+                EXIT_WITH_USAGE(train_offline_usage);
+            std::vector<std::string> segments(argv + 4, argv + argc);
+            std::shared_ptr<FIRNet> net = std::make_shared<FIRNet>(verno);
+            show_global_cfg(std::cout);
+            net->show_param(std::cout);
+            train_offline(net, segments, passes);
+            return 0;
+        }
+        EXIT_WITH_USAGE(train_offline_usage);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "ladder") == 0) {
+        if (argc >= 5) {
+            int itermax = std::atoi(argv[3]);
+            std::vector<long long> vernos;
+            for (int i = 4; i < argc; ++i) {
+                const char *at = strrchr(argv[i], '@');
+                long long verno = std::atoll(at != nullptr ? at + 1 : argv[i]);
+                if (verno <= 0)
+                    EXIT_WITH_USAGE(ladder_usage);
+                // nets are loaded by verno from working directory, so a name must be the one this build uses
+                if (at != nullptr && argv[i] != FIRNet::param_file_name(verno)
+                        && argv[i] != FIRNet::param_file_name(verno, ".flat")) {
+                    std::cout << argv[i] << " is no checkpoint of this build, expected "
+                              << FIRNet::param_file_name(verno) << std::endl;
+                    return -1;
+                }
+                vernos.push_back(verno);
+            }
+            if (itermax <= 0)
+                EXIT_WITH_USAGE(ladder_usage);
+            int threads = std::max(int(std::thread::hardware_concurrency()), 1);
+            return ladder(vernos, argv[2], itermax, threads);
+        }
+        EXIT_WITH_USAGE(ladder_usage);
+    }
+
     EXIT_WITH_USAGE(usage);
 }
\ No newline at end of file
@@ -0,0 +1,167 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstdint>
+#include <cstdio>
+
+#include "mapped_file.h"
+
+#ifdef _WIN32
+
+MappedFile::MappedFile() : addr(nullptr), len(0), writable(false),
+    file_handle(INVALID_HANDLE_VALUE), map_handle(nullptr) {}
+
+bool MappedFile::map_view(size_t size) {
+    DWORD protect = writable ? PAGE_READWRITE : PAGE_READONLY;
+    DWORD access = writable ? FILE_MAP_WRITE : FILE_MAP_READ;
+    map_handle = CreateFileMappingA(file_handle, nullptr, protect,
+        DWORD(uint64_t(size) >> 32), DWORD(size & 0xffffffff), nullptr);
+    if (map_handle == nullptr)
+        return false;
+    addr = static_cast<char*>(MapViewOfFile(map_handle, access, 0, 0, size));
+    if (addr == nullptr)
+        return false;
+    len = size;
+    return true;
+}
+
+bool MappedFile::open_read(const std::string &path) {
+    close();
+    writable = false;
+    file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0 || !map_view(size_t(file_size.QuadPart))) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool MappedFile::open_write(const std::string &path, size_t size) {
+    close();
+    writable = true;
+    file_handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+        nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE || !map_view(size)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::flush() {
+    if (addr != nullptr && writable) {
+        FlushViewOfFile(addr, len);
+        FlushFileBuffers(file_handle);
+    }
+}
+
+void MappedFile::close() {
+    if (addr != nullptr)
+        UnmapViewOfFile(addr);
+    if (map_handle != nullptr)
+        CloseHandle(map_handle);
+    if (file_handle != INVALID_HANDLE_VALUE)
+        CloseHandle(file_handle);
+    addr = nullptr;
+    len = 0;
+    map_handle = nullptr;
+    file_handle = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+MappedFile::MappedFile() : addr(nullptr), len(0), writable(false), fd(-1) {}
+
+bool MappedFile::map_view(size_t size) {
+    int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void *ptr = mmap(nullptr, size, prot, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED)
+        return false;
+    addr = static_cast<char*>(ptr);
+    len = size;
+    return true;
+}
+
+bool MappedFile::open_read(const std::string &path) {
+    close();
+    writable = false;
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0 || !map_view(size_t(st.st_size))) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool MappedFile::open_write(const std::string &path, size_t size) {
+    close();
+    writable = true;
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t(st.st_size) < size && ftruncate(fd, off_t(size)) != 0) || !map_view(size)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::flush() {
+    if (addr != nullptr && writable)
+        msync(addr, len, MS_SYNC);
+}
+
+void MappedFile::close() {
+    if (addr != nullptr)
+        munmap(addr, len);
+    if (fd >= 0)
+        ::close(fd);
+    addr = nullptr;
+    len = 0;
+    fd = -1;
+}
+
+#endif
+
+bool sync_file(const std::string &path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    bool ok = FlushFileBuffers(file) != 0;
+    CloseHandle(file);
+    return ok;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool ok = fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+#endif
+}
+
+bool replace_file(const std::string &src, const std::string &dst) {
+    if (!sync_file(src))
+        return false;
+#ifdef _WIN32
+    return MoveFileExA(src.c_str(), dst.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return std::rename(src.c_str(), dst.c_str()) == 0;
+#endif
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+
+class MappedFile {
+    char *addr;
+    size_t len;
+    bool writable;
+#ifdef _WIN32
+    void *file_handle;
+    void *map_handle;
+#else
+    int fd;
+#endif
+    bool map_view(size_t size);
+public:
+    MappedFile();
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    bool open_read(const std::string &path);
+    bool open_write(const std::string &path, size_t size);
+    void flush();
+    void close();
+    bool is_open() const { return addr != nullptr; }
+    char *data() const { return addr; }
+    size_t size() const { return len; }
+};
+
+// flushes file contents to disk
+bool sync_file(const std::string &path);
+// overwrite dst with src in one step, readers never see a partial file
+// src is synced first, so a crash right after cannot leave dst pointing at unwritten data
+bool replace_file(const std::string &src, const std::string &dst);
@@ -80,8 +80,7 @@ Move MCTSNode::act_by_prob(float mcts_move_priors[BOARD_SIZE], float temp) const
     for (int i = 0; i < BOARD_SIZE; ++i)
         check_sum += mcts_move_priors[i];
     assert(check_sum > 0.99);
-    std::discrete_distribution<int> discrete(mcts_move_priors, mcts_move_priors + BOARD_SIZE);
-    return Move(discrete(global_random_engine));
+    return Move(sample_index(mcts_move_priors, BOARD_SIZE));
 }
 
 void MCTSNode::update(float leafValue) {
@@ -96,21 +95,9 @@ void MCTSNode::update_recursive(float leafValue) {
     update(leafValue);
 }
 
-void gen_ran_dirichlet(const size_t K, float alpha, float theta[]) {
-    std::gamma_distribution<float> gamma(alpha, 1.0f);
-    float norm = 0.0;
-    for (size_t i = 0; i < K; i++) {
-        theta[i] = gamma(global_random_engine);
-        norm += theta[i];
-    }
-    for (size_t i = 0; i < K; i++) {
-        theta[i] /= norm;
-    }
-}
-
 void MCTSNode::add_noise_to_child_prior(float noise_rate) {
     auto noise_added = new float[children.size()];
-    gen_ran_dirichlet(children.size(), DIRICHLET_ALPHA, noise_added);
+    sample_dirichlet(DIRICHLET_ALPHA, int(children.size()), noise_added);
     int prior_cnt = 0;
     for (auto &item : children) {
         item.second->prior = (1 - noise_rate) * item.second->prior + noise_rate * noise_added[prior_cnt];
@@ -119,6 +106,23 @@ void MCTSNode::add_noise_to_child_prior(float noise_rate) {
     delete [] noise_added;
 }
 
+long long MCTSNode::tree_size() const {
+    long long n = 1;
+    for (const auto &mn : children)
+        n += mn.second->tree_size();
+    return n;
+}
+
+bool SearchLimits::reached() const {
+    if (max_nodes > 0 && nodes >= max_nodes)
+        return true;
+    if (timed) {
+        auto left = deadline - std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(left).count() <= slowest_ns;
+    }
+    return false;
+}
+
 float MCTSNode::value(float c_puct) const {
     assert(!is_root());
     float N = float(parent->visits);
@@ -140,8 +144,51 @@ std::ostream &operator<<(std::ostream &out, const MCTSNode &node) {
      return out;
 }
 
+MCTSNode *descend(MCTSNode *root, State &state, float c_puct, int *depth) {
+    MCTSNode *node = root;
+    int n = 0;
+    while (!node->is_leaf()) {
+        auto move_node = node->select(c_puct);
+        node = move_node.second;
+        state.next(move_node.first);
+        ++n;
+    }
+    if (depth != nullptr)
+        *depth = n;
+    return node;
+}
+
+bool settle_leaf(MCTSNode *leaf, const State &state) {
+    if (state.over()) {
+        leaf->update_recursive(state.get_winner() != Color::Empty ? 1.0f : 0.0f);
+        return true;
+    }
+    if (ENABLE_TACTICS) {
+        Move win = VCFSolver(state.get_board()).solve(state.current());
+        if (win.z() != NO_MOVE_YET) {
+            leaf->expand({ std::make_pair(win, 1.0f) });
+            leaf->update_recursive(-1.0f);
+            return true;
+        }
+    }
+    return false;
+}
+
+void expand_leaf(MCTSNode *leaf, const State &state, float value, std::vector<std::pair<Move, float>> &move_priors) {
+    if (ENABLE_TACTICS)
+        prune_losing_moves(state, move_priors);
+    leaf->expand(move_priors);
+    leaf->update_recursive(-value);
+}
+
+MCTSNode *advance_root(MCTSNode *root, Move mv) {
+    MCTSNode *next = root->get_children().count(mv) > 0 ? root->cut(mv) : new MCTSNode(nullptr, 1.0f);
+    delete root;
+    return next;
+}
+
 MCTSPurePlayer::MCTSPurePlayer(int itermax, float c_puct)
-    : itermax(itermax), c_puct(c_puct) {
+    : itermax(itermax), c_puct(c_puct), stats_enabled(DEBUG_SEARCH_STATS) {
     make_id();
     root = new MCTSNode(nullptr, 1.0f);
 }
@@ -163,43 +210,82 @@ void MCTSPurePlayer::reset() {
 }
 
 Move MCTSPurePlayer::play(const State &state) {
-    if (!(state.get_last().z() == NO_MOVE_YET) && !root->is_leaf())
-        swap_root(root->cut(state.get_last()));
-    for (int i = 0; i < itermax; ++i) {
-        State state_copied(state);
-        MCTSNode *node = root;
-        while (!node->is_leaf()) {
-            auto move_node = node->select(c_puct);
-            node = move_node.second;
-            state_copied.next(move_node.first);
+    // opponent's reply may be missing from the tree, pruned by tactics or outside candidate range
+    if (!(state.get_last().z() == NO_MOVE_YET))
+        root = advance_root(root, state.get_last());
+    if (ENABLE_TACTICS) {
+        Move win = VCFSolver(state.get_board()).solve(state.current());
+        if (win.z() != NO_MOVE_YET) {
+            root = advance_root(root, win);
+            return win;
         }
-        Color enemy_side = state_copied.current();
-        Color winner = state_copied.get_winner();
-        if (!state_copied.over()) {
-            int n_options = state_copied.get_options().size();
-            std::vector<std::pair<Move, float>> move_priors;
-            for (const auto mv : state_copied.get_options()) {
-                move_priors.push_back(std::make_pair(mv, 1.0f / float(n_options)));
+    }
+    Move solved = endgame.best_move(state);
+    if (solved.z() != NO_MOVE_YET) {
+        root = advance_root(root, solved);
+        return solved;
+    }
+    SearchStats *sp = ENABLE_SEARCH_STATS && stats_enabled ? &stats : nullptr;
+    if (sp != nullptr)
+        sp->reset();
+    {
+        PhaseTimer think_timer(sp);
+        for (int i = 0; i < itermax; ++i) {
+            State state_copied(state);
+            MCTSNode *node = root;
+            int depth = 0;
+            while (!node->is_leaf()) {
+                std::pair<Move, MCTSNode*> move_node(Move(NO_MOVE_YET), nullptr);
+                {
+                    PhaseTimer timer(sp, SearchPhase::Select);
+                    move_node = node->select(c_puct);
+                }
+                PhaseTimer timer(sp, SearchPhase::Replay);
+                node = move_node.second;
+                state_copied.next(move_node.first);
+                ++depth;
+            }
+            Color enemy_side = state_copied.current();
+            Color winner = state_copied.get_winner();
+            if (!state_copied.over()) {
+                {
+                    PhaseTimer timer(sp, SearchPhase::Expand);
+                    int n_options = state_copied.get_candidates().size();
+                    std::vector<std::pair<Move, float>> move_priors;
+                    for (const auto mv : state_copied.get_candidates()) {
+                        move_priors.push_back(std::make_pair(mv, 1.0f / float(n_options)));
+                    }
+                    node->expand(move_priors);
+                    if (sp != nullptr)
+                        sp->expanded_nodes += n_options;
+                }
+                PhaseTimer timer(sp, SearchPhase::Evaluate);
+                winner = state_copied.next_rand_till_end();
+                if (sp != nullptr)
+                    ++sp->evaluations;
             }
-            node->expand(move_priors);
-            winner = state_copied.next_rand_till_end();
+            float leaf_value;
+            if (winner == enemy_side)
+                leaf_value = -1.0f;
+            else if (winner == ~enemy_side)
+                leaf_value = 1.0f;
+            else
+                leaf_value = 0.0f;
+            PhaseTimer timer(sp, SearchPhase::Backup);
+            node->update_recursive(leaf_value);
+            if (sp != nullptr)
+                sp->add_simulation(depth);
         }
-        float leaf_value;
-        if (winner == enemy_side)
-            leaf_value = -1.0f;
-        else if (winner == ~enemy_side)
-            leaf_value = 1.0f;
-        else
-            leaf_value = 0.0f;
-        node->update_recursive(leaf_value);
     }
+    if (sp != nullptr && DEBUG_SEARCH_STATS)
+        std::cout << id << ": " << stats << std::endl;
     Move act = root->act_by_most_visted();
     swap_root(root->cut(act));
     return act;
 }
 
 MCTSDeepPlayer::MCTSDeepPlayer(std::shared_ptr<FIRNet> nn, int itermax, float c_puct)
-    : itermax(itermax), c_puct(c_puct), net(nn) {
+    : itermax(itermax), c_puct(c_puct), net(nn), stats_enabled(DEBUG_SEARCH_STATS), limited(false) {
     make_id();
     root = new MCTSNode(nullptr, 1.0f);
 }
@@ -216,23 +302,59 @@ void MCTSDeepPlayer::reset() {
 }
 
 void MCTSDeepPlayer::think(int itermax, float c_puct, const State &state,
-        std::shared_ptr<FIRNet> net, MCTSNode *root, bool add_noise_to_root) {
+        std::shared_ptr<FIRNet> net, MCTSNode *root, bool add_noise_to_root, SearchStats *stats, SearchLimits *limits) {
+    SearchStats *sp = ENABLE_SEARCH_STATS ? stats : nullptr;
+    PhaseTimer think_timer(sp);
     if (add_noise_to_root)
         root->add_noise_to_child_prior(NOISE_RATE);
     for (int i = 0; i < itermax; ++i) {
+        // two simulations always run, so that root has a visited child to act on
+        if (limits != nullptr && i >= 2 && limits->reached())
+            break;
+        std::chrono::steady_clock::time_point sim_begin;
+        if (limits != nullptr)
+            sim_begin = std::chrono::steady_clock::now();
         State state_copied(state);
         MCTSNode *node = root;
+        int depth = 0;
         while (!node->is_leaf()) {
-            auto move_node = node->select(c_puct);
+            std::pair<Move, MCTSNode*> move_node(Move(NO_MOVE_YET), nullptr);
+            {
+                PhaseTimer timer(sp, SearchPhase::Select);
+                move_node = node->select(c_puct);
+            }
+            PhaseTimer timer(sp, SearchPhase::Replay);
             node = move_node.second;
             state_copied.next(move_node.first);
+            ++depth;
         }
         float leaf_value;
         if (!state_copied.over()) {
             std::vector<std::pair<Move, float>> net_move_priors;
-            net->forward(state_copied, &leaf_value, net_move_priors);
+            Move win(NO_MOVE_YET);
+            if (ENABLE_TACTICS) {
+                PhaseTimer timer(sp, SearchPhase::Expand);
+                win = VCFSolver(state_copied.get_board()).solve(state_copied.current());
+            }
+            if (win.z() != NO_MOVE_YET) {
+                // proven win for side to move at leaf, no need to ask network
+                net_move_priors.push_back(std::make_pair(win, 1.0f));
+                leaf_value = 1.0f;
+            }
+            else {
+                net->forward(state_copied, &leaf_value, net_move_priors, sp);
+            }
+            PhaseTimer timer(sp, SearchPhase::Expand);
+            if (ENABLE_TACTICS && win.z() == NO_MOVE_YET)
+                prune_losing_moves(state_copied, net_move_priors);
             node->expand(net_move_priors);
             leaf_value *= -1;
+            if (limits != nullptr)
+                limits->nodes += net_move_priors.size();
+            if (sp != nullptr) {
+                sp->evaluations += win.z() == NO_MOVE_YET ? 1 : 0;
+                sp->expanded_nodes += net_move_priors.size();
+            }
         }
         else {
             if (state_copied.get_winner() != Color::Empty)
@@ -240,14 +362,56 @@ void MCTSDeepPlayer::think(int itermax, float c_puct, const State &state,
             else
                 leaf_value = 0.0f;
         }
-        node->update_recursive(leaf_value);
+        {
+            PhaseTimer timer(sp, SearchPhase::Backup);
+            node->update_recursive(leaf_value);
+            if (sp != nullptr)
+                sp->add_simulation(depth);
+        }
+        if (limits != nullptr) {
+            long long sim_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - sim_begin).count();
+            if (sim_ns > limits->slowest_ns)
+                limits->slowest_ns = sim_ns;
+        }
     }
 }
 
 Move MCTSDeepPlayer::play(const State &state) {
-    if (!(state.get_last().z() == NO_MOVE_YET) && !root->is_leaf())
-        swap_root(root->cut(state.get_last()));
-    think(itermax, c_puct, state, net, root);
+    // opponent's reply may be missing from the tree, pruned by tactics or outside candidate range
+    if (!(state.get_last().z() == NO_MOVE_YET))
+        root = advance_root(root, state.get_last());
+    if (ENABLE_TACTICS) {
+        Move win = VCFSolver(state.get_board()).solve(state.current());
+        if (win.z() != NO_MOVE_YET) {
+            root = advance_root(root, win);
+            return win;
+        }
+    }
+    Move solved = endgame.best_move(state);
+    if (solved.z() != NO_MOVE_YET) {
+        root = advance_root(root, solved);
+        return solved;
+    }
+    SearchStats *sp = ENABLE_SEARCH_STATS && stats_enabled ? &stats : nullptr;
+    if (sp != nullptr)
+        sp->reset();
+    SearchLimits *lp = nullptr;
+    if (limited) {
+        lp = &limits;
+        lp->nodes = 0;
+        if (lp->max_nodes > 0) {
+            lp->nodes = root->tree_size();
+            // reused subtree already eats most of memory budget, start over
+            if (lp->nodes > lp->max_nodes / 2) {
+                reset();
+                lp->nodes = 1;
+            }
+        }
+    }
+    think(itermax, c_puct, state, net, root, false, sp, lp);
+    if (sp != nullptr && DEBUG_SEARCH_STATS)
+        std::cout << id << ": " << stats << std::endl;
     Move act = root->act_by_prob(nullptr, 1e-3);
     swap_root(root->cut(act));
     return act;
@@ -1,9 +1,12 @@
 #pragma once
 
+#include <chrono>
 #include <map>
 
 #include "game.h"
 #include "network.h"
+#include "stats.h"
+#include "threat.h"
 
 class MCTSNode {
     friend std::ostream &operator<<(std::ostream &out, const MCTSNode &node);
@@ -26,19 +29,52 @@ public:
     float value(float c_puct) const;
     bool is_leaf() const { return children.size() == 0; }
     bool is_root() const { return parent == nullptr; }
+    long long tree_size() const;
+    int get_visits() const { return visits; }
+    float get_quality() const { return quality; }
+    float get_prior() const { return prior; }
+    const std::map<Move, MCTSNode*> &get_children() const { return children; }
 };
 std::ostream &operator<<(std::ostream &out, const MCTSNode &node);
 
+// steps of one simulation, for searches that evaluate leaves outside of think
+MCTSNode *descend(MCTSNode *root, State &state, float c_puct, int *depth = nullptr);
+// backs up a leaf that needs no network(game over or proven win), returns false if it needs evaluation
+bool settle_leaf(MCTSNode *leaf, const State &state);
+// expands leaf with network output of its state and backs up the value
+void expand_leaf(MCTSNode *leaf, const State &state, float value, std::vector<std::pair<Move, float>> &move_priors);
+
+// moves root down to the child of mv, keeping its subtree if already expanded
+MCTSNode *advance_root(MCTSNode *root, Move mv);
+
+// rough heap cost of one tree node including its entry in parent's children map
+constexpr size_t MCTS_NODE_BYTES = sizeof(MCTSNode) + 64;
+
+// extra stop conditions of a search besides itermax, checked between simulations
+struct SearchLimits {
+    bool timed = false;
+    std::chrono::steady_clock::time_point deadline;
+    long long max_nodes = 0; // zero means unbounded
+    long long nodes = 0;
+    long long slowest_ns = 0;
+    bool reached() const;
+};
+
 class MCTSPurePlayer: public Player {
     std::string id;
     int itermax;
     float c_puct;
     MCTSNode *root;
+    SearchStats stats;
+    bool stats_enabled;
+    EndgameSolver endgame;
     void swap_root(MCTSNode * new_root) { delete root; root = new_root; }
 public:
     MCTSPurePlayer(int itermax, float c_puct);
     ~MCTSPurePlayer() { delete root; }
     const std::string &name() const override { return id; }
+    void enable_stats(bool on) { stats_enabled = on; }
+    const SearchStats &get_stats() const { return stats; }
     void set_itermax(int n);
     void make_id();
     void reset() override;
@@ -52,15 +88,25 @@ class MCTSDeepPlayer : public Player {
     float c_puct;
     MCTSNode *root;
     std::shared_ptr<FIRNet> net;
+    SearchStats stats;
+    bool stats_enabled;
+    SearchLimits limits;
+    bool limited;
+    EndgameSolver endgame;
     void swap_root(MCTSNode * new_root) { delete root; root = new_root; }
 public:
     MCTSDeepPlayer(std::shared_ptr<FIRNet> nn, int itermax, float c_puct);
     ~MCTSDeepPlayer() { delete root; }
     const std::string &name() const override { return id; }
+    void enable_stats(bool on) { stats_enabled = on; }
+    const SearchStats &get_stats() const { return stats; }
+    void set_limits(const SearchLimits &lim) { limits = lim; limited = true; }
+    void clear_limits() { limited = false; }
     void make_id();
     void reset() override;
     Move play(const State &state) override;
     static void think(int itermax, float c_puct, const State &state,
-        std::shared_ptr<FIRNet> net, MCTSNode *root, bool add_noise_to_root = false);
+        std::shared_ptr<FIRNet> net, MCTSNode *root, bool add_noise_to_root = false,
+        SearchStats *stats = nullptr, SearchLimits *limits = nullptr);
 };
 
@@ -1,6 +1,9 @@
+#include <chrono>
 #include <iomanip>
+#include <fstream>
 
 #include "network.h"
+#include "mapped_file.h"
 
 #define MX_TRY \
   try {
@@ -96,25 +99,316 @@ std::ostream &operator<<(std::ostream &out, const MiniBatch &batch) {
     return out;
 }
 
-void DataSet::push_with_transform(SampleData *data) {
-    for (int i = 0; i < 4; ++i) {
-        data->transpose();
-        push_back(data);
-        data->flip_verticing();
-        push_back(data);
+const int *transform_table(int id) {
+    static int table[TRANSFORM_NUM][BOARD_SIZE];
+    static bool ready = [] {
+        for (int t = 0; t < TRANSFORM_NUM; ++t)
+            for (int z = 0; z < BOARD_SIZE; ++z)
+                table[t][z] = mapping_move(t, Move(z)).z();
+        return true;
+    }();
+    (void)ready;
+    return table[id];
+}
+
+void CompactSample::pack(const SampleData &sample) {
+    own.reset();
+    enemy.reset();
+    last = NO_MOVE_YET;
+    for (int z = 0; z < BOARD_SIZE; ++z) {
+        own[z] = sample.data[z] > 0;
+        enemy[z] = sample.data[BOARD_SIZE + z] > 0;
+        if (INPUT_FEATURE_NUM > 2 && sample.data[2 * BOARD_SIZE + z] > 0)
+            last = int16_t(z);
+        p_label[z] = uint16_t(std::lround(sample.p_label[z] * 65535.0f));
+    }
+    first_hand = INPUT_FEATURE_NUM > 3 && sample.data[3 * BOARD_SIZE] > 0;
+    count = 1;
+    v_label = sample.v_label[0];
+}
+
+struct PositionKeys {
+    uint64_t own[BOARD_SIZE];
+    uint64_t enemy[BOARD_SIZE];
+    uint64_t last[BOARD_SIZE];
+    uint64_t first_hand;
+    PositionKeys() {
+        Xoshiro256 rng(0xd1ce);
+        for (int z = 0; z < BOARD_SIZE; ++z) {
+            own[z] = rng();
+            enemy[z] = rng();
+            last[z] = rng();
+        }
+        first_hand = rng();
+    }
+};
+
+uint64_t CompactSample::position_key(int transform_id) const {
+    static const PositionKeys keys;
+    const int *table = transform_table(transform_id);
+    uint64_t key = first_hand ? keys.first_hand : 0;
+    if (last != NO_MOVE_YET)
+        key ^= keys.last[table[last]];
+    for (int z = 0; z < BOARD_SIZE; ++z) {
+        if (own[z])
+            key ^= keys.own[table[z]];
+        else if (enemy[z])
+            key ^= keys.enemy[table[z]];
+    }
+    return key;
+}
+
+uint64_t CompactSample::canonicalize() {
+    uint64_t best = position_key(0);
+    int best_id = 0;
+    for (int t = 1; t < TRANSFORM_NUM; ++t) {
+        uint64_t key = position_key(t);
+        if (key < best) {
+            best = key;
+            best_id = t;
+        }
+    }
+    if (best_id != 0) {
+        const CompactSample from = *this;
+        const int *table = transform_table(best_id);
+        for (int z = 0; z < BOARD_SIZE; ++z) {
+            own[table[z]] = from.own[z];
+            enemy[table[z]] = from.enemy[z];
+            p_label[table[z]] = from.p_label[z];
+        }
+        if (last != NO_MOVE_YET)
+            last = int16_t(table[last]);
+    }
+    return best;
+}
+
+bool CompactSample::same_position(const CompactSample &other) const {
+    return own == other.own && enemy == other.enemy && last == other.last && first_hand == other.first_hand;
+}
+
+void CompactSample::merge(const CompactSample &other) {
+    float w = float(std::min(count, uint32_t(std::max(REPLAY_MERGE_CAP - 1, 0))));
+    float scale = 1.0f / (w + other.count);
+    v_label = (v_label * w + other.v_label * other.count) * scale;
+    for (int z = 0; z < BOARD_SIZE; ++z)
+        p_label[z] = uint16_t(std::lround((p_label[z] * w + other.p_label[z] * float(other.count)) * scale));
+    count += other.count;
+}
+
+void CompactSample::unpack(float data[], float p_label[], float v_label[], int transform_id) const {
+    const int *table = transform_table(transform_id);
+    std::fill(data, data + INPUT_FEATURE_NUM * BOARD_SIZE, 0.0f);
+    for (int z = 0; z < BOARD_SIZE; ++z) {
+        int m = table[z];
+        data[m] = own[z] ? 1.0f : 0.0f;
+        data[BOARD_SIZE + m] = enemy[z] ? 1.0f : 0.0f;
+        p_label[m] = this->p_label[z] / 65535.0f;
+    }
+    if (INPUT_FEATURE_NUM > 2 && last != NO_MOVE_YET)
+        data[2 * BOARD_SIZE + table[last]] = 1.0f;
+    if (INPUT_FEATURE_NUM > 3 && first_hand)
+        std::fill(data + 3 * BOARD_SIZE, data + 4 * BOARD_SIZE, 1.0f);
+    v_label[0] = this->v_label;
+}
+
+DataSet::DataSet() : index(0), merge_cnt(0), header(nullptr) {
+    buf = new CompactSample[BUFFER_SIZE];
+    rebuild_index();
+}
+
+DataSet::DataSet(const std::string &file_name, bool reattach) : index(0), merge_cnt(0), buf(nullptr), header(nullptr) {
+    size_t file_size = REPLAY_DATA_OFFSET + sizeof(CompactSample) * BUFFER_SIZE;
+    if (!file.open_write(file_name, file_size)) {
+        std::cout << "failed to map replay file: " << file_name << std::endl;
+        std::exit(-1);
+    }
+    header = reinterpret_cast<ReplayFileHeader*>(file.data());
+    buf = reinterpret_cast<CompactSample*>(file.data() + REPLAY_DATA_OFFSET);
+    if (reattach && std::equal(REPLAY_FILE_MAGIC, REPLAY_FILE_MAGIC + 4, header->magic)
+            && header->version == REPLAY_FILE_VERSION
+            && header->sample_size == sizeof(CompactSample)
+            && header->capacity == BUFFER_SIZE) {
+        index = (long long)header->total;
+        merge_cnt = (long long)header->merged;
+        LOG(INFO) << "reattached replay file " << file_name << ", dataset_total=" << index
+                  << ", dataset_merged=" << merge_cnt;
     }
+    else {
+        std::copy(REPLAY_FILE_MAGIC, REPLAY_FILE_MAGIC + 4, header->magic);
+        header->version = REPLAY_FILE_VERSION;
+        header->sample_size = sizeof(CompactSample);
+        header->capacity = BUFFER_SIZE;
+        header->total = 0;
+        header->merged = 0;
+        LOG(INFO) << "created replay file " << file_name;
+    }
+    rebuild_index();
+}
+
+DataSet::~DataSet() {
+    if (file.is_open())
+        file.flush();
+    else
+        delete [] buf;
+}
+
+void DataSet::rebuild_index() {
+    key_slot.clear();
+    slot_key.assign(BUFFER_SIZE, 0);
+    weight_tree.assign(BUFFER_SIZE + 1, 0);
+    weight_sum = 0;
+    for (int i = 0; i < size(); ++i) {
+        slot_key[i] = buf[i].position_key(0);
+        if (REPLAY_MERGE_CAP > 0)
+            key_slot[slot_key[i]] = i;
+        add_weight(i, buf[i].count);
+    }
+}
+
+void DataSet::add_weight(int slot, long long delta) {
+    weight_sum += delta;
+    for (int i = slot + 1; i <= BUFFER_SIZE; i += i & -i)
+        weight_tree[i] += delta;
+}
+
+int DataSet::find_weight(long long target) const {
+    int slot = 0;
+    int step = 1;
+    while (step * 2 <= BUFFER_SIZE)
+        step *= 2;
+    for (; step > 0; step /= 2) {
+        if (slot + step <= BUFFER_SIZE && weight_tree[slot + step] <= target) {
+            slot += step;
+            target -= weight_tree[slot];
+        }
+    }
+    return slot;
+}
+
+void DataSet::push_back(const SampleData *data) {
+    CompactSample packed;
+    packed.pack(*data);
+    uint64_t key = REPLAY_MERGE_CAP > 0 ? packed.canonicalize() : packed.position_key(0);
+    std::lock_guard<std::mutex> lock(mtx);
+    if (REPLAY_MERGE_CAP > 0) {
+        auto it = key_slot.find(key);
+        if (it != key_slot.end() && buf[it->second].same_position(packed)) {
+            buf[it->second].merge(packed);
+            add_weight(it->second, packed.count);
+            ++merge_cnt;
+            if (header != nullptr)
+                header->merged = uint64_t(merge_cnt.load());
+            return;
+        }
+    }
+    int slot = int(index % BUFFER_SIZE);
+    if (index >= BUFFER_SIZE) {
+        auto it = key_slot.find(slot_key[slot]);
+        if (it != key_slot.end() && it->second == slot)
+            key_slot.erase(it);
+        add_weight(slot, -(long long)buf[slot].count);
+    }
+    buf[slot] = packed;
+    slot_key[slot] = key;
+    if (REPLAY_MERGE_CAP > 0)
+        key_slot[key] = slot;
+    add_weight(slot, packed.count);
+    ++index;
+    if (header != nullptr)
+        header->total = uint64_t(index.load());
+}
+
+SampleData DataSet::get(int i) const {
+    assert(i < size());
+    SampleData sample;
+    std::lock_guard<std::mutex> lock(mtx);
+    buf[i].unpack(sample, 0);
+    return sample;
 }
 
 void DataSet::make_mini_batch(MiniBatch *batch) const {
     assert(index > BATCH_SIZE);
-    std::uniform_int_distribution<int> uniform(0, size() - 1);
+    std::vector<CompactSample> picked(BATCH_SIZE);
+    {
+        // slots drawn by count, so a merged position is seen as often as its separate copies would be
+        std::lock_guard<std::mutex> lock(mtx);
+        auto &rng = thread_random_engine();
+        for (auto &item : picked)
+            item = buf[find_weight((long long)(rng() % uint64_t(weight_sum)))];
+    }
+    auto &rng = thread_random_engine();
     for (int i = 0; i < BATCH_SIZE; i++) {
-        int c = uniform(global_random_engine);
-        SampleData *r = buf + c;
-        std::copy(std::begin(r->data), std::end(r->data), batch->data + INPUT_FEATURE_NUM * BOARD_SIZE * i);
-        std::copy(std::begin(r->p_label), std::end(r->p_label), batch->p_label + BOARD_SIZE * i);
-        std::copy(std::begin(r->v_label), std::end(r->v_label), batch->v_label + i);
+        picked[i].unpack(batch->data + INPUT_FEATURE_NUM * BOARD_SIZE * i,
+            batch->p_label + BOARD_SIZE * i, batch->v_label + i, rng.below(TRANSFORM_NUM));
+    }
+}
+
+BatchPrefetcher::BatchPrefetcher(const DataSet &dataset, int batch_num, int thread_num)
+        : dataset(dataset), stopping(false), assemble_ns(0), assemble_cnt(0) {
+    for (int i = 0; i < batch_num; ++i) {
+        pool.push_back(new MiniBatch());
+        empty.push_back(pool.back());
     }
+    for (int i = 0; i < thread_num; ++i)
+        workers.emplace_back(&BatchPrefetcher::work, this);
+}
+
+BatchPrefetcher::~BatchPrefetcher() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    empty_cond.notify_all();
+    filled_cond.notify_all();
+    for (auto &worker : workers)
+        worker.join();
+    for (auto batch : pool)
+        delete batch;
+}
+
+void BatchPrefetcher::work() {
+    for (;;) {
+        MiniBatch *batch;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            empty_cond.wait(lock, [this] { return stopping || !empty.empty(); });
+            if (stopping)
+                return;
+            batch = empty.front();
+            empty.pop_front();
+        }
+        while (dataset.total() <= BATCH_SIZE) {
+            if (stopping)
+                return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        auto begin = std::chrono::steady_clock::now();
+        dataset.make_mini_batch(batch);
+        assemble_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - begin).count();
+        ++assemble_cnt;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            filled.push_back(batch);
+        }
+        filled_cond.notify_one();
+    }
+}
+
+MiniBatch *BatchPrefetcher::acquire() {
+    std::unique_lock<std::mutex> lock(mtx);
+    filled_cond.wait(lock, [this] { return !filled.empty(); });
+    auto batch = filled.front();
+    filled.pop_front();
+    return batch;
+}
+
+void BatchPrefetcher::release(MiniBatch *batch) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        empty.push_back(batch);
+    }
+    empty_cond.notify_one();
 }
 
 std::ostream &operator<<(std::ostream &out, const DataSet &set) {
@@ -194,27 +488,47 @@ std::pair<Symbol, Symbol> val_layer(Symbol data, Symbol label) {
     return std::make_pair(val_out, val_loss);
 }
 
-FIRNet::FIRNet(long long verno) : update_cnt(verno), ctx(Context::cpu()),
+FIRNet::FIRNet(long long verno, bool predict_only) : update_cnt(verno), ctx(Context::cpu()),
         data_predict(NDArray(Shape(1, INPUT_FEATURE_NUM, BOARD_MAX_ROW, BOARD_MAX_COL), ctx)),
-        data_train(NDArray(Shape(BATCH_SIZE, INPUT_FEATURE_NUM, BOARD_MAX_ROW, BOARD_MAX_COL), ctx)),
-        plc_label(NDArray(Shape(BATCH_SIZE, BOARD_SIZE), ctx)),
-        val_label(NDArray(Shape(BATCH_SIZE, 1), ctx)) {
+        data_train(NDArray(Shape(TRAIN_SHARD_SIZE, INPUT_FEATURE_NUM, BOARD_MAX_ROW, BOARD_MAX_COL), ctx)),
+        plc_label(NDArray(Shape(TRAIN_SHARD_SIZE, BOARD_SIZE), ctx)),
+        val_label(NDArray(Shape(TRAIN_SHARD_SIZE, 1), ctx)),
+        plc_ensemble(nullptr), val_ensemble(nullptr), plc_batch(nullptr), val_batch(nullptr),
+        loss_train(nullptr), learning_rate(0.0f), batch_size(0), use_ensemble(false) {
     MX_TRY
     build_graph();
-    if (update_cnt > 0)
+    if (predict_only) {
+        assert(update_cnt > 0);
+        if (!load_flat_param())
+            load_param();
+        bind_predict();
+        return;
+    }
+    if (update_cnt > 0) {
         load_param();
+        load_momentum();
+    }
     bind_train();
     if (update_cnt == 0) {
         loss.InferArgsMap(ctx, &args_map, args_map);
         auxs_map = loss_train->aux_dict();
         init_param();
     }
+    bind_replicas();
+    bind_predict();
+    learning_rate = calc_init_lr();
+    MX_CATCH
+}
+
+FIRNet::FIRNet(ParamBuffer &buffer) : update_cnt(-1), ctx(Context::cpu()),
+        data_predict(NDArray(Shape(1, INPUT_FEATURE_NUM, BOARD_MAX_ROW, BOARD_MAX_COL), ctx)),
+        plc_ensemble(nullptr), val_ensemble(nullptr), plc_batch(nullptr), val_batch(nullptr),
+        loss_train(nullptr), learning_rate(0.0f), batch_size(0), use_ensemble(false) {
+    MX_TRY
+    assert(buffer.verno() >= 0);
+    build_graph();
+    import_param(buffer);
     bind_predict();
-    optimizer = OptimizerRegistry::Find("sgd");
-    optimizer->SetParam("momentum", 0.9)
-        ->SetParam("clip_gradient", 10)
-        ->SetParam("lr", calc_init_lr())
-        ->SetParam("wd", WEIGHT_DECAY);
     MX_CATCH
 }
 
@@ -241,17 +555,21 @@ void FIRNet::adjust_lr() {
     case LR_DROP_STEP3: multiplier = 1e-3; break;
     }
     if (multiplier < 1.0f) {
-        float lr = INIT_LEARNING_RATE  * multiplier;
-        optimizer->SetParam("lr", lr);
-        LOG(INFO) << "adjusted learning_rate=" << lr;
+        learning_rate = INIT_LEARNING_RATE  * multiplier;
+        LOG(INFO) << "adjusted learning_rate=" << learning_rate;
     }
 }
 
 FIRNet::~FIRNet() {
     delete plc_predict;
     delete val_predict;
+    delete plc_ensemble;
+    delete val_ensemble;
+    delete plc_batch;
+    delete val_batch;
     delete loss_train;
-    delete optimizer;
+    for (auto &replica : replicas)
+        delete replica.loss_train;
     //MXNotifyShutdown();
 }
 
@@ -275,6 +593,43 @@ void FIRNet::bind_train() {
         auxs_map);
 }
 
+void FIRNet::bind_replicas() {
+    NDArray::WaitAll();
+    for (int i = 1; i < TRAIN_REPLICA_NUM; ++i) {
+        replicas.emplace_back(i);
+        auto &replica = replicas.back();
+        for (const auto &arg : args_map)
+            replica.args_map[arg.first] = arg.second.Copy(replica.ctx);
+        for (const auto &aux : auxs_map)
+            replica.auxs_map[aux.first] = aux.second.Copy(replica.ctx);
+        replica.loss_train = loss.SimpleBind(replica.ctx, replica.args_map,
+            std::map<std::string, NDArray>(),
+            std::map<std::string, OpReqType>(),
+            replica.auxs_map);
+    }
+    NDArray::WaitAll();
+}
+
+void FIRNet::reduce_replicas() {
+    for (int i = 0; i < loss_arg_names.size(); ++i) {
+        if (loss_arg_names[i] == "data" || loss_arg_names[i] == "plc_label" ||
+            loss_arg_names[i] == "val_label")
+            continue;
+        auto &grad = loss_train->grad_arrays[i];
+        for (auto &replica : replicas)
+            grad += replica.loss_train->grad_arrays[i].Copy(ctx);
+        grad /= float(TRAIN_REPLICA_NUM);
+    }
+    for (int i = 0; i < loss_train->aux_arrays.size(); ++i) {
+        auto &aux = loss_train->aux_arrays[i];
+        for (auto &replica : replicas)
+            aux += replica.loss_train->aux_arrays[i].Copy(ctx);
+        aux /= float(TRAIN_REPLICA_NUM);
+        for (auto &replica : replicas)
+            aux.CopyTo(&replica.loss_train->aux_arrays[i]);
+    }
+}
+
 void FIRNet::bind_predict() {
     args_map["data"] = data_predict;
     plc_predict = plc.SimpleBind(ctx, args_map,
@@ -290,6 +645,52 @@ void FIRNet::bind_predict() {
     args_map.erase("val_label");
 }
 
+void FIRNet::bind_ensemble() {
+    data_ensemble = NDArray(Shape(TRANSFORM_NUM, INPUT_FEATURE_NUM, BOARD_MAX_ROW, BOARD_MAX_COL), ctx);
+    args_map["data"] = data_ensemble;
+    plc_ensemble = plc.SimpleBind(ctx, args_map,
+        std::map<std::string, NDArray>(),
+        std::map<std::string, OpReqType>(),
+        auxs_map);
+    val_ensemble = val.SimpleBind(ctx, args_map,
+        std::map<std::string, NDArray>(),
+        std::map<std::string, OpReqType>(),
+        auxs_map);
+    args_map.erase("data");
+}
+
+void FIRNet::bind_batch(int size) {
+    MX_TRY
+    assert(size > 0);
+    delete plc_batch;
+    delete val_batch;
+    batch_size = size;
+    const int rows = size * (use_ensemble ? TRANSFORM_NUM : 1);
+    data_batch = NDArray(Shape(rows, INPUT_FEATURE_NUM, BOARD_MAX_ROW, BOARD_MAX_COL), ctx);
+    args_map["data"] = data_batch;
+    plc_batch = plc.SimpleBind(ctx, args_map,
+        std::map<std::string, NDArray>(),
+        std::map<std::string, OpReqType>(),
+        auxs_map);
+    val_batch = val.SimpleBind(ctx, args_map,
+        std::map<std::string, NDArray>(),
+        std::map<std::string, OpReqType>(),
+        auxs_map);
+    args_map.erase("data");
+    MX_CATCH
+}
+
+void FIRNet::set_ensemble(bool on) {
+    MX_TRY
+    if (on && plc_ensemble == nullptr)
+        bind_ensemble();
+    bool changed = use_ensemble != on;
+    use_ensemble = on;
+    if (changed && plc_batch != nullptr)
+        bind_batch(batch_size);
+    MX_CATCH
+}
+
 void FIRNet::init_param() {
     auto xavier_init = Xavier(Xavier::gaussian, Xavier::in, 2.34);
     for (auto &arg : args_map) {
@@ -305,13 +706,17 @@ void FIRNet::init_param() {
     }
 }
 
-std::string FIRNet::make_param_file_name() {
+std::string FIRNet::param_file_name(long long verno, const std::string &suffix) {
     std::ostringstream filename;
     filename << "FIR-" << BOARD_MAX_COL << "x" << NET_NUM_FILTER
-        << "i" << NET_NUM_RESIDUAL_BLOCK << "@" << update_cnt << ".param";
+        << "i" << NET_NUM_RESIDUAL_BLOCK << "@" << verno << suffix;
     return filename.str();
 }
 
+std::string FIRNet::make_param_file_name(const std::string &suffix) {
+    return param_file_name(update_cnt, suffix);
+}
+
 void FIRNet::load_param() {
     MX_TRY
     auto file_name = make_param_file_name();
@@ -321,20 +726,215 @@ void FIRNet::load_param() {
     for (const auto &param : param_map) {
         if (param.first.size() > 5 && param.first.substr(0, 5) == "_AUX_")
             auxs_map.insert(std::make_pair(param.first.substr(5), param.second));
+        else if (param.first.size() > 5 && param.first.substr(0, 5) == "_MOM_")
+            continue; // momentum of earlier checkpoints, now kept in .opt
         else
             args_map.insert(std::make_pair(param.first, param.second));
     }
     MX_CATCH
 }
 
+void FIRNet::load_momentum() {
+    MX_TRY
+    auto file_name = make_param_file_name(".opt");
+    if (!std::ifstream(file_name).good()) {
+        LOG(INFO) << "no optimizer state in " << file_name << ", momentum starts from zero";
+        return;
+    }
+    LOG(INFO) << "loading optimizer state from " << file_name;
+    NDArray::Load(file_name, nullptr, &momentum_map);
+    MX_CATCH
+}
+
 void FIRNet::save_param() {
+    ParamBuffer buffer, optimizer;
+    export_param(buffer);
+    export_momentum(optimizer);
+    if (!optimizer.save(make_param_file_name(".opt")) || !buffer.save(make_param_file_name()))
+        LOG(INFO) << "failed to save parameters into " << make_param_file_name();
+}
+
+bool ParamBuffer::save(const std::string &file_name) {
     MX_TRY
-    auto file_name = make_param_file_name();
     LOG(INFO) << "saving parameters into " << file_name;
+    std::map<std::string, NDArray> param_map;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (const auto &param : params)
+            param_map.insert(std::make_pair(param.first,
+                NDArray(param.second.data.data(), Shape(param.second.shape), Context::cpu())));
+    }
+    auto tmp_name = file_name + ".tmp";
+    NDArray::Save(tmp_name, param_map);
+    return replace_file(tmp_name, file_name);
+    MX_CATCH
+}
+
+uint64_t align_flat_offset(uint64_t offset) {
+    return (offset + FLAT_PARAM_ALIGN - 1) / FLAT_PARAM_ALIGN * FLAT_PARAM_ALIGN;
+}
+
+bool check_flat_param(const char *data, size_t size) {
+    const auto header = reinterpret_cast<const FlatParamHeader*>(data);
+    const auto table = reinterpret_cast<const FlatParamEntry*>(data + sizeof(FlatParamHeader));
+    bool valid = size >= sizeof(FlatParamHeader)
+        && std::equal(FLAT_PARAM_MAGIC, FLAT_PARAM_MAGIC + 4, header->magic)
+        && header->version == FLAT_PARAM_VERSION
+        && header->file_size == size
+        && sizeof(FlatParamHeader) + header->tensor_num * sizeof(FlatParamEntry) <= size;
+    for (uint32_t i = 0; valid && i < header->tensor_num; ++i) {
+        const auto &entry = table[i];
+        valid = entry.ndim > 0 && entry.ndim <= FLAT_PARAM_MAX_DIM && entry.name[FLAT_PARAM_NAME_LEN - 1] == '\0'
+            && entry.offset % FLAT_PARAM_ALIGN == 0 && entry.size <= size && entry.offset <= size - entry.size;
+        // readers take element count from shape, so it must cover exactly the bytes of entry
+        uint64_t elems = 1;
+        for (uint32_t d = 0; valid && d < entry.ndim; ++d) {
+            valid = entry.shape[d] == 0 || elems <= entry.size / sizeof(float) / entry.shape[d];
+            elems *= entry.shape[d];
+        }
+        valid = valid && elems * sizeof(float) == entry.size;
+    }
+    return valid;
+}
+
+void ParamBuffer::save_flat(std::string &bytes) {
+    std::lock_guard<std::mutex> lock(mtx);
+    FlatParamHeader header = {};
+    std::copy(FLAT_PARAM_MAGIC, FLAT_PARAM_MAGIC + 4, header.magic);
+    header.version = FLAT_PARAM_VERSION;
+    header.tensor_num = uint32_t(params.size());
+    header.update_cnt = uint64_t(update_cnt.load());
+    std::vector<FlatParamEntry> table(params.size());
+    uint64_t offset = align_flat_offset(sizeof(FlatParamHeader) + table.size() * sizeof(FlatParamEntry));
+    int i = 0;
+    for (const auto &param : params) {
+        auto &entry = table[i++];
+        entry = FlatParamEntry();
+        if (param.first.size() >= FLAT_PARAM_NAME_LEN || param.second.shape.size() > FLAT_PARAM_MAX_DIM) {
+            std::cout << "parameter not representable in flat format: " << param.first << std::endl;
+            std::exit(-1);
+        }
+        std::copy(param.first.begin(), param.first.end(), entry.name);
+        entry.ndim = uint32_t(param.second.shape.size());
+        std::copy(param.second.shape.begin(), param.second.shape.end(), entry.shape);
+        entry.offset = offset;
+        entry.size = param.second.data.size() * sizeof(float);
+        offset = align_flat_offset(offset + entry.size);
+    }
+    header.file_size = offset;
+    bytes.assign(size_t(header.file_size), '\0');
+    std::copy_n(reinterpret_cast<const char*>(&header), sizeof(header), &bytes[0]);
+    std::copy_n(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(FlatParamEntry),
+        &bytes[sizeof(header)]);
+    i = 0;
+    for (const auto &param : params) {
+        const auto &entry = table[i++];
+        std::copy_n(reinterpret_cast<const char*>(param.second.data.data()), entry.size, &bytes[entry.offset]);
+    }
+}
+
+bool ParamBuffer::load_flat(const char *data, size_t size) {
+    if (!check_flat_param(data, size))
+        return false;
+    const auto header = reinterpret_cast<const FlatParamHeader*>(data);
+    const auto table = reinterpret_cast<const FlatParamEntry*>(data + sizeof(FlatParamHeader));
+    std::lock_guard<std::mutex> lock(mtx);
+    params.clear();
+    for (uint32_t i = 0; i < header->tensor_num; ++i) {
+        const auto &entry = table[i];
+        auto &tensor = params[std::string(entry.name)];
+        tensor.shape.assign(entry.shape, entry.shape + entry.ndim);
+        const float *ptr = reinterpret_cast<const float*>(data + entry.offset);
+        tensor.data.assign(ptr, ptr + entry.size / sizeof(float));
+    }
+    update_cnt = (long long)header->update_cnt;
+    return true;
+}
+
+void FIRNet::save_flat_param() {
+    auto file_name = make_param_file_name(".flat");
+    LOG(INFO) << "saving flat parameters into " << file_name;
+    ParamBuffer buffer;
+    export_param(buffer);
+    std::string bytes;
+    buffer.save_flat(bytes);
+    std::ofstream out(file_name, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), bytes.size());
+    if (!out) {
+        std::cout << "failed to write " << file_name << std::endl;
+        std::exit(-1);
+    }
+}
+
+bool FIRNet::load_flat_param() {
+    MX_TRY
+    auto file_name = make_param_file_name(".flat");
+    MappedFile file;
+    if (!file.open_read(file_name))
+        return false;
+    LOG(INFO) << "loading flat parameters from " << file_name;
+    const auto header = reinterpret_cast<const FlatParamHeader*>(file.data());
+    const auto table = reinterpret_cast<const FlatParamEntry*>(file.data() + sizeof(FlatParamHeader));
+    if (!check_flat_param(file.data(), file.size()) || header->update_cnt != uint64_t(update_cnt)) {
+        std::cout << "corrupted or incompatible flat parameter file: " << file_name << std::endl;
+        std::exit(-1);
+    }
+    for (uint32_t i = 0; i < header->tensor_num; ++i) {
+        const auto &entry = table[i];
+        std::string name(entry.name);
+        std::vector<mx_uint> dims(entry.shape, entry.shape + entry.ndim);
+        NDArray nd(reinterpret_cast<const float*>(file.data() + entry.offset), Shape(dims), ctx);
+        if (name.size() > 5 && name.substr(0, 5) == "_AUX_")
+            auxs_map.insert(std::make_pair(name.substr(5), nd));
+        else
+            args_map.insert(std::make_pair(name, nd));
+    }
+    NDArray::WaitAll();
+    return true;
+    MX_CATCH
+}
+
+void FIRNet::export_param(ParamBuffer &buffer) {
     std::map<std::string, NDArray> param_map(args_map);
     for (const auto &aux : auxs_map)
         param_map.insert(std::make_pair("_AUX_" + aux.first, aux.second));
-    NDArray::Save(file_name, param_map);
+    copy_into(buffer, param_map);
+}
+
+void FIRNet::export_momentum(ParamBuffer &buffer) {
+    copy_into(buffer, momentum_map);
+}
+
+void FIRNet::copy_into(ParamBuffer &buffer, const std::map<std::string, NDArray> &param_map) {
+    MX_TRY
+    std::lock_guard<std::mutex> lock(buffer.mtx);
+    for (const auto &param : param_map) {
+        auto &tensor = buffer.params[param.first];
+        param.second.WaitToRead();
+        tensor.shape = param.second.GetShape();
+        const float *ptr = param.second.GetData();
+        tensor.data.assign(ptr, ptr + param.second.Size());
+    }
+    buffer.update_cnt = update_cnt;
+    MX_CATCH
+}
+
+bool FIRNet::import_param(ParamBuffer &buffer) {
+    if (buffer.verno() == update_cnt)
+        return false;
+    MX_TRY
+    std::lock_guard<std::mutex> lock(buffer.mtx);
+    for (const auto &param : buffer.params) {
+        bool is_aux = param.first.size() > 5 && param.first.substr(0, 5) == "_AUX_";
+        auto &target = is_aux ? auxs_map : args_map;
+        auto name = is_aux ? param.first.substr(5) : param.first;
+        auto iter = target.find(name);
+        if (iter == target.end())
+            iter = target.insert(std::make_pair(name, NDArray(Shape(param.second.shape), ctx))).first;
+        iter->second.SyncCopyFromCPU(param.second.data.data(), param.second.data.size());
+    }
+    update_cnt = buffer.update_cnt;
+    return true;
     MX_CATCH
 }
 
@@ -417,26 +1017,13 @@ Move mapping_move(int id, Move mv) {
     return mv;
 }
 
-void FIRNet::forward(const State &state,
-        float value[1], std::vector<std::pair<Move, float>> &net_move_priors) {
-    MX_TRY
-    float data[INPUT_FEATURE_NUM * BOARD_SIZE] = { 0.0f };
-    state.fill_feature_array(data);
-    std::uniform_int_distribution<int> uniform(0, 7);
-    int transform_id = uniform(global_random_engine);
-    mapping_data(transform_id, data);
-    data_predict.SyncCopyFromCPU(data, INPUT_FEATURE_NUM * BOARD_SIZE);
-    plc_predict->Forward(false);
-    val_predict->Forward(false);
-    NDArray::WaitAll();
-    const float *plc_ptr = plc_predict->outputs[0].GetData();
-    float priors_sum = 0.0f;
-    for (const auto mv : state.get_options()) {
-        Move mapped = mapping_move(transform_id, mv);
-        float prior = plc_ptr[mapped.z()];
-        net_move_priors.push_back(std::make_pair(mv, prior));
-        priors_sum += prior;
-    }
+// input tensors live in host memory, so features are written in place instead of staged and copied
+float *writable_data(NDArray &array) {
+    array.WaitToWrite();
+    return const_cast<float*>(array.GetData());
+}
+
+void normalize_move_priors(std::vector<std::pair<Move, float>> &net_move_priors, float priors_sum) {
     if (priors_sum < 1e-8) {
         LOG(INFO) << "wield policy probality yield by network: sum=" << priors_sum
             << ", available_move_n=" << net_move_priors.size();
@@ -447,26 +1034,168 @@ void FIRNet::forward(const State &state,
         for (auto &item : net_move_priors)
             item.second /= priors_sum;
     }
+}
+
+void FIRNet::forward(const State &state,
+        float value[1], std::vector<std::pair<Move, float>> &net_move_priors, SearchStats *stats) {
+    if (use_ensemble) {
+        forward_ensemble(state, value, net_move_priors, stats);
+        return;
+    }
+    MX_TRY
+    const int *table = transform_table(thread_random_engine().below(TRANSFORM_NUM));
+    {
+        PhaseTimer timer(stats, SearchPhase::Encode);
+        state.write_features(writable_data(data_predict), table);
+    }
+    PhaseTimer timer(stats, SearchPhase::Evaluate);
+    plc_predict->Forward(false);
+    val_predict->Forward(false);
+    plc_predict->outputs[0].WaitToRead();
+    val_predict->outputs[0].WaitToRead();
+    const float *plc_ptr = plc_predict->outputs[0].GetData();
+    float priors_sum = 0.0f;
+    for (const auto mv : state.get_candidates()) {
+        float prior = plc_ptr[table[mv.z()]];
+        net_move_priors.push_back(std::make_pair(mv, prior));
+        priors_sum += prior;
+    }
+    normalize_move_priors(net_move_priors, priors_sum);
     value[0] = val_predict->outputs[0].GetData()[0];
     MX_CATCH
 }
 
+void FIRNet::forward_ensemble(const State &state,
+        float value[1], std::vector<std::pair<Move, float>> &net_move_priors, SearchStats *stats) {
+    MX_TRY
+    {
+        PhaseTimer timer(stats, SearchPhase::Encode);
+        constexpr int feature_size = INPUT_FEATURE_NUM * BOARD_SIZE;
+        float *data = writable_data(data_ensemble);
+        for (int t = 0; t < TRANSFORM_NUM; ++t)
+            state.write_features(data + t * feature_size, transform_table(t));
+    }
+    PhaseTimer timer(stats, SearchPhase::Evaluate);
+    plc_ensemble->Forward(false);
+    val_ensemble->Forward(false);
+    plc_ensemble->outputs[0].WaitToRead();
+    val_ensemble->outputs[0].WaitToRead();
+    const float *plc_ptr = plc_ensemble->outputs[0].GetData();
+    const float *val_ptr = val_ensemble->outputs[0].GetData();
+    float priors_sum = 0.0f;
+    for (const auto mv : state.get_candidates()) {
+        float prior = 0.0f;
+        for (int t = 0; t < TRANSFORM_NUM; ++t)
+            prior += plc_ptr[t * BOARD_SIZE + transform_table(t)[mv.z()]];
+        prior /= float(TRANSFORM_NUM);
+        net_move_priors.push_back(std::make_pair(mv, prior));
+        priors_sum += prior;
+    }
+    normalize_move_priors(net_move_priors, priors_sum);
+    float value_sum = 0.0f;
+    for (int t = 0; t < TRANSFORM_NUM; ++t)
+        value_sum += val_ptr[t];
+    value[0] = value_sum / float(TRANSFORM_NUM);
+    MX_CATCH
+}
+
+void FIRNet::forward_batch(const std::vector<const State*> &states,
+        float values[], std::vector<std::vector<std::pair<Move, float>>> &net_move_priors) {
+    assert(plc_batch != nullptr && states.size() <= batch_size);
+    MX_TRY
+    constexpr int feature_size = INPUT_FEATURE_NUM * BOARD_SIZE;
+    // every state takes copies rows in a row, all symmetries under ensemble or one random otherwise
+    const int copies = use_ensemble ? TRANSFORM_NUM : 1;
+    std::vector<const int*> tables(states.size() * copies);
+    float *data = writable_data(data_batch);
+    for (int i = 0; i < tables.size(); ++i) {
+        tables[i] = transform_table(use_ensemble ? i % TRANSFORM_NUM : thread_random_engine().below(TRANSFORM_NUM));
+        states[i / copies]->write_features(data + i * feature_size, tables[i]);
+    }
+    plc_batch->Forward(false);
+    val_batch->Forward(false);
+    plc_batch->outputs[0].WaitToRead();
+    val_batch->outputs[0].WaitToRead();
+    const float *plc_ptr = plc_batch->outputs[0].GetData();
+    const float *val_ptr = val_batch->outputs[0].GetData();
+    net_move_priors.resize(states.size());
+    for (int i = 0; i < states.size(); ++i) {
+        auto &move_priors = net_move_priors[i];
+        move_priors.clear();
+        float priors_sum = 0.0f;
+        for (const auto mv : states[i]->get_candidates()) {
+            float prior = 0.0f;
+            for (int r = i * copies; r < (i + 1) * copies; ++r)
+                prior += plc_ptr[r * BOARD_SIZE + tables[r][mv.z()]];
+            prior /= float(copies);
+            move_priors.push_back(std::make_pair(mv, prior));
+            priors_sum += prior;
+        }
+        normalize_move_priors(move_priors, priors_sum);
+        float value_sum = 0.0f;
+        for (int r = i * copies; r < (i + 1) * copies; ++r)
+            value_sum += val_ptr[r];
+        values[i] = value_sum / float(copies);
+    }
+    MX_CATCH
+}
+
+// same update as mxnet sgd optimizer, but momentum kept by name so checkpoints can save and restore it
+void FIRNet::sgd_update(const std::string &name, NDArray &weight, NDArray &grad) {
+    auto iter = momentum_map.find(name);
+    if (iter == momentum_map.end()) {
+        iter = momentum_map.insert(std::make_pair(name, NDArray(weight.GetShape(), ctx))).first;
+        iter->second = 0.0f;
+    }
+    Operator("sgd_mom_update")
+        .SetParam("lr", learning_rate)
+        .SetParam("wd", WEIGHT_DECAY)
+        .SetParam("momentum", 0.9f)
+        .SetParam("clip_gradient", 10.0f)
+        .SetInput("weight", weight)
+        .SetInput("grad", grad)
+        .SetInput("mom", iter->second)
+        .Invoke(weight);
+}
+
 float FIRNet::train_step(const MiniBatch *batch) {
+    assert(loss_train != nullptr);
     MX_TRY
-    data_train.SyncCopyFromCPU(batch->data, BATCH_SIZE * INPUT_FEATURE_NUM * BOARD_SIZE);
-    plc_label.SyncCopyFromCPU(batch->p_label, BATCH_SIZE * BOARD_SIZE);
-    val_label.SyncCopyFromCPU(batch->v_label, BATCH_SIZE);
+    constexpr int data_size = TRAIN_SHARD_SIZE * INPUT_FEATURE_NUM * BOARD_SIZE;
+    constexpr int plc_size = TRAIN_SHARD_SIZE * BOARD_SIZE;
+    data_train.SyncCopyFromCPU(batch->data, data_size);
+    plc_label.SyncCopyFromCPU(batch->p_label, plc_size);
+    val_label.SyncCopyFromCPU(batch->v_label, TRAIN_SHARD_SIZE);
+    for (int r = 0; r < replicas.size(); ++r) {
+        auto &replica = replicas[r];
+        replica.args_map["data"].SyncCopyFromCPU(batch->data + (r + 1) * data_size, data_size);
+        replica.args_map["plc_label"].SyncCopyFromCPU(batch->p_label + (r + 1) * plc_size, plc_size);
+        replica.args_map["val_label"].SyncCopyFromCPU(batch->v_label + (r + 1) * TRAIN_SHARD_SIZE, TRAIN_SHARD_SIZE);
+    }
     loss_train->Forward(true);
     loss_train->Backward();
+    for (auto &replica : replicas) {
+        replica.loss_train->Forward(true);
+        replica.loss_train->Backward();
+    }
+    if (!replicas.empty())
+        reduce_replicas();
     for (int i = 0; i < loss_arg_names.size(); ++i) {
         if (loss_arg_names[i] == "data" || loss_arg_names[i] == "plc_label" ||
             loss_arg_names[i] == "val_label")
             continue;
-        optimizer->Update(i, loss_train->arg_arrays[i], loss_train->grad_arrays[i]);
+        sgd_update(loss_arg_names[i], loss_train->arg_arrays[i], loss_train->grad_arrays[i]);
+        for (auto &replica : replicas)
+            loss_train->arg_arrays[i].CopyTo(&replica.loss_train->arg_arrays[i]);
     }
     ++update_cnt;
     adjust_lr();
-    NDArray::WaitAll();
-    return loss_train->outputs[0].GetData()[0];
+    loss_train->outputs[0].WaitToRead();
+    float loss_sum = loss_train->outputs[0].GetData()[0];
+    for (auto &replica : replicas) {
+        replica.loss_train->outputs[0].WaitToRead();
+        loss_sum += replica.loss_train->outputs[0].GetData()[0];
+    }
+    return loss_sum / float(TRAIN_REPLICA_NUM);
     MX_CATCH
-}
\ No newline at end of file
+}
@@ -1,8 +1,52 @@
 #pragma once
 
+#include <atomic>
+#include <bitset>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <mxnet-cpp/MxNetCpp.h>
 
 #include "game.h"
+#include "mapped_file.h"
+#include "stats.h"
+
+constexpr int TRANSFORM_NUM = 8;
+constexpr int TRAIN_SHARD_SIZE = BATCH_SIZE / TRAIN_REPLICA_NUM;
+static_assert(BATCH_SIZE % TRAIN_REPLICA_NUM == 0, "batch must split evenly across train replicas");
+
+/*
+flat parameter file layout, all integers little-endian:
+  FlatParamHeader
+  FlatParamEntry[tensor_num]
+  tensor data, each starting at a FLAT_PARAM_ALIGN-byte boundary
+*/
+constexpr char FLAT_PARAM_MAGIC[4] = { 'F', 'I', 'R', 'W' };
+constexpr uint32_t FLAT_PARAM_VERSION = 1;
+constexpr uint64_t FLAT_PARAM_ALIGN = 64;
+constexpr int FLAT_PARAM_NAME_LEN = 64;
+constexpr int FLAT_PARAM_MAX_DIM = 4;
+
+struct FlatParamHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t tensor_num;
+    uint32_t reserved;
+    uint64_t update_cnt;
+    uint64_t file_size;
+};
+
+struct FlatParamEntry {
+    char name[FLAT_PARAM_NAME_LEN];
+    uint32_t ndim;
+    uint32_t shape[FLAT_PARAM_MAX_DIM];
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+};
 
 struct SampleData {
     float data[INPUT_FEATURE_NUM * BOARD_SIZE] = { 0.0f };
@@ -14,6 +58,29 @@ struct SampleData {
 };
 std::ostream &operator<<(std::ostream &out, const SampleData &sample);
 
+// one position as stored in replay buffer, expanded into SampleData at batch time
+struct CompactSample {
+    std::bitset<BOARD_SIZE> own;
+    std::bitset<BOARD_SIZE> enemy;
+    int16_t last;
+    bool first_hand;
+    uint32_t count; // samples of this position merged into slot, its weight in mini batch sampling
+    float v_label;
+    uint16_t p_label[BOARD_SIZE];
+
+    void pack(const SampleData &sample);
+    uint64_t position_key(int transform_id) const;
+    // turns sample into the symmetry of least key, equal for all eight symmetries of a position
+    uint64_t canonicalize();
+    bool same_position(const CompactSample &other) const;
+    // folds targets of same position in, averaging over at most REPLAY_MERGE_CAP latest samples
+    void merge(const CompactSample &other);
+    void unpack(float data[], float p_label[], float v_label[], int transform_id) const;
+    void unpack(SampleData &sample, int transform_id) const {
+        unpack(sample.data, sample.p_label, sample.v_label, transform_id);
+    }
+};
+
 struct MiniBatch {
     float data[BATCH_SIZE * INPUT_FEATURE_NUM * BOARD_SIZE] = { 0.0f };
     float p_label[BATCH_SIZE * BOARD_SIZE] = { 0.0f };
@@ -21,53 +88,164 @@ struct MiniBatch {
 };
 std::ostream &operator<<(std::ostream &out, const MiniBatch &batch);
 
+void mapping_data(int id, float data[INPUT_FEATURE_NUM * BOARD_SIZE]);
+Move mapping_move(int id, Move mv);
+
+/*
+replay file layout:
+  ReplayFileHeader, padded to REPLAY_DATA_OFFSET
+  CompactSample[capacity] used as ring, slot = total % capacity
+repeated positions are merged into their live slot instead of taking a new one, so total counts slots written
+*/
+constexpr char REPLAY_FILE_MAGIC[4] = { 'F', 'I', 'R', 'R' };
+constexpr uint32_t REPLAY_FILE_VERSION = 2;
+constexpr size_t REPLAY_DATA_OFFSET = 64;
+
+struct ReplayFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t sample_size;
+    uint32_t capacity;
+    uint64_t total;
+    uint64_t merged;
+};
+
 class DataSet {
 private:
-    long long index;
-    SampleData *buf;
+    std::atomic<long long> index;
+    std::atomic<long long> merge_cnt;
+    CompactSample *buf;
+    MappedFile file;
+    ReplayFileHeader *header;
+    std::unordered_map<uint64_t, int> key_slot;
+    std::vector<uint64_t> slot_key;
+    std::vector<long long> weight_tree; // fenwick tree over slot counts
+    long long weight_sum;
+    mutable std::mutex mtx;
+    void rebuild_index();
+    void add_weight(int slot, long long delta);
+    int find_weight(long long target) const;
 public:
-    DataSet() : index(0) { buf = new SampleData[BUFFER_SIZE]; }
-    ~DataSet() { delete [] buf; }
-    int size() const { return (index > BUFFER_SIZE) ? BUFFER_SIZE : index; }
+    DataSet();
+    DataSet(const std::string &file_name, bool reattach);
+    ~DataSet();
+    int size() const { long long n = index; return (n > BUFFER_SIZE) ? BUFFER_SIZE : int(n); }
     long long total() const { return index; }
-    void push_back(const SampleData *data) { buf[index % BUFFER_SIZE] = *data; ++index; }
-    void push_with_transform(SampleData *data);
-    const SampleData &get(int i) const { assert(i < size()); return buf[i]; }
+    long long merged() const { return merge_cnt; }
+    void push_back(const SampleData *data);
+    SampleData get(int i) const;
     void make_mini_batch(MiniBatch *batch) const;
 };
 std::ostream &operator<<(std::ostream &out, const DataSet &set);
 
+// keeps a pool of reusable mini batches filled from dataset by background threads
+class BatchPrefetcher {
+    const DataSet &dataset;
+    std::vector<MiniBatch*> pool;
+    std::deque<MiniBatch*> filled;
+    std::deque<MiniBatch*> empty;
+    std::vector<std::thread> workers;
+    std::mutex mtx;
+    std::condition_variable filled_cond;
+    std::condition_variable empty_cond;
+    std::atomic<bool> stopping;
+    std::atomic<long long> assemble_ns;
+    std::atomic<long long> assemble_cnt;
+    void work();
+public:
+    BatchPrefetcher(const DataSet &dataset, int batch_num, int thread_num);
+    ~BatchPrefetcher();
+    long long assemble_time_ns() const { return assemble_ns; }
+    long long assembled() const { return assemble_cnt; }
+    MiniBatch *acquire();
+    void release(MiniBatch *batch);
+};
+
+// latest published weights of a training net, copied into inference nets between moves
+class ParamBuffer {
+    friend class FIRNet;
+    struct Tensor {
+        std::vector<mx_uint> shape;
+        std::vector<float> data;
+    };
+    std::mutex mtx;
+    std::map<std::string, Tensor> params;
+    std::atomic<long long> update_cnt;
+public:
+    ParamBuffer() : update_cnt(-1) {}
+    long long verno() const { return update_cnt; }
+    void save_flat(std::string &bytes);
+    bool load_flat(const char *data, size_t size);
+    // writes in NDArray::Save format through a temporary file, can run off the training thread
+    bool save(const std::string &file_name);
+};
+
 class FIRNet {
     using Symbol = mxnet::cpp::Symbol;
     using Context = mxnet::cpp::Context;
     using NDArray = mxnet::cpp::NDArray;
     using Executor = mxnet::cpp::Executor;
-    using Optimizer = mxnet::cpp::Optimizer;
+
+    // extra data-parallel copy of training executor, working on its own slice of mini batch
+    struct TrainReplica {
+        Context ctx;
+        std::map<std::string, NDArray> args_map;
+        std::map<std::string, NDArray> auxs_map;
+        Executor *loss_train;
+        TrainReplica(int dev_id) : ctx(Context::cpu(dev_id)), loss_train(nullptr) {}
+    };
 
     const Context ctx;
     std::map<std::string, NDArray> args_map;
     std::map<std::string, NDArray> auxs_map;
     std::vector<std::string> loss_arg_names;
     Symbol plc, val, loss;
-    NDArray data_predict, data_train, plc_label, val_label;
-    Executor *plc_predict, *val_predict, *loss_train;
-    Optimizer* optimizer;
+    NDArray data_predict, data_ensemble, data_batch, data_train, plc_label, val_label;
+    Executor *plc_predict, *val_predict, *plc_ensemble, *val_ensemble, *plc_batch, *val_batch, *loss_train;
+    std::map<std::string, NDArray> momentum_map;
+    float learning_rate;
+    std::vector<TrainReplica> replicas;
+    int batch_size;
     long long update_cnt;
+    bool use_ensemble;
+    void bind_replicas();
+    void reduce_replicas();
+    void sgd_update(const std::string &name, NDArray &weight, NDArray &grad);
+    void copy_into(ParamBuffer &buffer, const std::map<std::string, NDArray> &param_map);
+    void forward_ensemble(const State &state,
+        float value[1], std::vector<std::pair<Move, float>> &move_priors, SearchStats *stats);
 public:
-    FIRNet(long long verno);
+    FIRNet(long long verno, bool predict_only = false);
+    FIRNet(ParamBuffer &buffer);
     ~FIRNet();
     long long verno() { return update_cnt; }
     void init_param();
+    // weights into .param, sgd momentum beside them into .opt so inference never loads it
     void save_param();
     void load_param();
+    void load_momentum();
+    void save_flat_param();
+    bool load_flat_param();
+    void export_param(ParamBuffer &buffer);
+    void export_momentum(ParamBuffer &buffer);
+    bool import_param(ParamBuffer &buffer);
     void show_param(std::ostream &out);
     void build_graph();
     void bind_train();
     void bind_predict();
+    void bind_ensemble();
+    void set_ensemble(bool on);
+    void bind_batch(int size);
+    int get_batch_size() const { return batch_size; }
     float calc_init_lr();
     void adjust_lr();
-    std::string make_param_file_name();
+    static std::string param_file_name(long long verno, const std::string &suffix = ".param");
+    std::string make_param_file_name(const std::string &suffix = ".param");
     float train_step(const MiniBatch *batch);
     void forward(const State &state,
-        float value[1], std::vector<std::pair<Move, float>> &move_priors);
+        float value[1], std::vector<std::pair<Move, float>> &move_priors, SearchStats *stats = nullptr);
+    // evaluates up to batch_size states in one call, requires bind_batch first
+    // under ensemble each state is averaged over all symmetries like forward_ensemble
+    void forward_batch(const std::vector<const State*> &states,
+        float values[], std::vector<std::vector<std::pair<Move, float>>> &move_priors);
 };
@@ -0,0 +1,233 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <limits>
+#include <sstream>
+
+#include "protocol.h"
+#include "mcts.h"
+
+class ProtocolEngine {
+    std::ostream &out;
+    MCTSDeepPlayer player;
+    State state;
+    std::vector<Move> history;
+    long long timeout_turn = 30000; // milliseconds, zero means play as fast as possible
+    long long timeout_match = 0;    // milliseconds, zero means no limit
+    long long time_left = std::numeric_limits<long long>::max();
+    long long max_memory = 0;       // bytes, zero means no limit
+    bool started = false;
+
+    bool parse_move(const std::string &text, Move &mv, int *field = nullptr) const;
+    bool rebuild(const std::vector<Move> &own, const std::vector<Move> &enemy);
+    void restart();
+    void think_and_answer(std::chrono::steady_clock::time_point received);
+    void set_info(const std::string &key, const std::string &value);
+public:
+    ProtocolEngine(std::shared_ptr<FIRNet> net, int itermax, std::ostream &out)
+        : out(out), player(net, itermax, C_PUCT) {}
+    bool handle(const std::string &command, const std::string &args, std::istream &in,
+        std::chrono::steady_clock::time_point received);
+};
+
+bool ProtocolEngine::parse_move(const std::string &text, Move &mv, int *field) const {
+    std::istringstream line_stream(text);
+    int x, y;
+    char comma;
+    if (!(line_stream >> x >> comma >> y) || comma != ',')
+        return false;
+    if (field != nullptr && !(line_stream >> comma >> *field))
+        return false;
+    if (!ON_BOARD(y, x))
+        return false;
+    mv = Move(y, x);
+    return true;
+}
+
+// stones of BOARD command come without turn order between colors, interleave them so that we move next
+bool ProtocolEngine::rebuild(const std::vector<Move> &own, const std::vector<Move> &enemy) {
+    if (own.size() != enemy.size() && own.size() + 1 != enemy.size())
+        return false;
+    bool enemy_first = enemy.size() > own.size();
+    std::vector<Move> moves;
+    for (size_t i = 0; i < enemy.size(); ++i) {
+        if (!enemy_first)
+            moves.push_back(own[i]);
+        moves.push_back(enemy[i]);
+        if (enemy_first && i < own.size())
+            moves.push_back(own[i]);
+    }
+    State rebuilt;
+    for (auto mv : moves) {
+        if (rebuilt.over() || !rebuilt.valid(mv))
+            return false;
+        rebuilt.next(mv);
+    }
+    state = rebuilt;
+    history = moves;
+    return true;
+}
+
+void ProtocolEngine::restart() {
+    state = State();
+    history.clear();
+    player.reset();
+}
+
+void ProtocolEngine::think_and_answer(std::chrono::steady_clock::time_point received) {
+    if (state.over()) {
+        out << "ERROR game is already over" << std::endl;
+        return;
+    }
+    long long budget = timeout_turn > 0 ? timeout_turn : 0;
+    if (timeout_match > 0) {
+        long long moves_to_go = std::max<long long>(state.get_options().size() / 2, PROTOCOL_MIN_MOVES_TO_GO);
+        budget = std::min(budget, time_left / moves_to_go);
+    }
+    budget = std::max(budget - PROTOCOL_TIME_MARGIN_MS, 0LL);
+
+    SearchLimits limits;
+    limits.timed = true;
+    limits.deadline = received + std::chrono::milliseconds(budget);
+    if (max_memory > 0) {
+        long long tree_bytes = max_memory - PROTOCOL_MEMORY_RESERVE_MB * (1LL << 20);
+        limits.max_nodes = std::max<long long>(tree_bytes / MCTS_NODE_BYTES, 4 * BOARD_SIZE);
+    }
+    player.set_limits(limits);
+    Move mv = player.play(state);
+    state.next(mv);
+    history.push_back(mv);
+    if (timeout_match > 0) {
+        time_left -= std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - received).count();
+    }
+    out << mv.c() << "," << mv.r() << std::endl;
+}
+
+void ProtocolEngine::set_info(const std::string &key, const std::string &value) {
+    long long number = std::atoll(value.c_str());
+    if (key == "timeout_turn")
+        timeout_turn = number;
+    else if (key == "timeout_match")
+        timeout_match = number;
+    else if (key == "time_left")
+        time_left = number;
+    else if (key == "max_memory")
+        max_memory = number;
+}
+
+bool ProtocolEngine::handle(const std::string &command, const std::string &args, std::istream &in,
+        std::chrono::steady_clock::time_point received) {
+    if (command == "END") {
+        return false;
+    }
+    else if (command == "START" || command == "RECTSTART") {
+        std::istringstream arg_stream(args);
+        int width = 0, height = 0;
+        char comma = ',';
+        arg_stream >> width;
+        height = width;
+        if (command == "RECTSTART")
+            arg_stream >> comma >> height;
+        if (width != BOARD_MAX_COL || height != BOARD_MAX_ROW || comma != ',') {
+            out << "ERROR unsupported board size, only " << BOARD_MAX_COL << "x" << BOARD_MAX_ROW
+                << " is supported" << std::endl;
+            return true;
+        }
+        started = true;
+        restart();
+        out << "OK" << std::endl;
+    }
+    else if (command == "ABOUT") {
+        out << "name=\"gomoku\", version=\"" << player.name() << "\"" << std::endl;
+    }
+    else if (command == "INFO") {
+        std::istringstream arg_stream(args);
+        std::string key, value;
+        arg_stream >> key >> value;
+        set_info(key, value);
+    }
+    else if (!started) {
+        out << "ERROR no START command yet" << std::endl;
+    }
+    else if (command == "RESTART") {
+        restart();
+        out << "OK" << std::endl;
+    }
+    else if (command == "BEGIN") {
+        restart();
+        think_and_answer(received);
+    }
+    else if (command == "TURN") {
+        Move mv(NO_MOVE_YET);
+        if (!parse_move(args, mv) || state.over() || !state.valid(mv)) {
+            out << "ERROR invalid move: " << args << std::endl;
+            return true;
+        }
+        state.next(mv);
+        history.push_back(mv);
+        think_and_answer(received);
+    }
+    else if (command == "BOARD") {
+        std::vector<Move> own, enemy;
+        bool valid = true;
+        std::string line;
+        while (std::getline(in, line)) {
+            line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+            if (line == "DONE")
+                break;
+            Move mv(NO_MOVE_YET);
+            int field = 0;
+            if (!parse_move(line, mv, &field) || field < 1 || field > 3)
+                valid = false;
+            else if (field == 1)
+                own.push_back(mv);
+            else if (field == 2)
+                enemy.push_back(mv);
+        }
+        player.reset();
+        if (!valid || !rebuild(own, enemy)) {
+            restart();
+            out << "ERROR invalid board position" << std::endl;
+            return true;
+        }
+        think_and_answer(received);
+    }
+    else if (command == "TAKEBACK") {
+        Move mv(NO_MOVE_YET);
+        if (!parse_move(args, mv) || history.empty() || !(history.back() == mv)) {
+            out << "ERROR cannot take back: " << args << std::endl;
+            return true;
+        }
+        history.pop_back();
+        std::vector<Move> moves(history);
+        restart();
+        for (auto one : moves)
+            state.next(one);
+        history = moves;
+        out << "OK" << std::endl;
+    }
+    else {
+        out << "UNKNOWN command " << command << std::endl;
+    }
+    return true;
+}
+
+int run_protocol(std::shared_ptr<FIRNet> net, int itermax, std::istream &in, std::ostream &out) {
+    ProtocolEngine engine(net, itermax, out);
+    std::string line;
+    while (std::getline(in, line)) {
+        auto received = std::chrono::steady_clock::now();
+        line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+        std::istringstream line_stream(line);
+        std::string command, args;
+        line_stream >> command;
+        std::getline(line_stream >> std::ws, args);
+        if (command.empty())
+            continue;
+        std::transform(command.begin(), command.end(), command.begin(), ::toupper);
+        if (!engine.handle(command, args, in, received))
+            break;
+    }
+    return 0;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <iostream>
+
+#include "network.h"
+
+/*
+Piskvork/Gomocup text protocol, one command per line:
+  START n, RECTSTART w,h, RESTART, BEGIN, TURN x,y, BOARD .. DONE,
+  TAKEBACK x,y, INFO key value, ABOUT, END
+x is column and y is row, both zero based
+*/
+int run_protocol(std::shared_ptr<FIRNet> net, int itermax, std::istream &in, std::ostream &out);
@@ -0,0 +1,130 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+#include "random.h"
+
+uint64_t splitmix64(uint64_t &x) {
+    uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void Xoshiro256::reseed(uint64_t seed) {
+    for (int i = 0; i < 4; ++i)
+        s[i] = splitmix64(seed);
+}
+
+void Xoshiro256::jump() {
+    static const uint64_t table[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+        0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+    uint64_t t[4] = { 0, 0, 0, 0 };
+    for (auto word : table) {
+        for (int b = 0; b < 64; ++b) {
+            if (word & (uint64_t(1) << b)) {
+                for (int i = 0; i < 4; ++i)
+                    t[i] ^= s[i];
+            }
+            (*this)();
+        }
+    }
+    for (int i = 0; i < 4; ++i)
+        s[i] = t[i];
+}
+
+uint64_t make_master_seed() {
+    if (RANDOM_SEED != 0)
+        return RANDOM_SEED;
+    std::random_device device;
+    return (uint64_t(device()) << 32) ^ device()
+        ^ uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+}
+
+std::atomic<uint64_t> master_seed(make_master_seed());
+std::atomic<int> stream_cnt(0);
+
+void set_random_seed(uint64_t seed) {
+    master_seed = seed;
+    stream_cnt = 0;
+}
+
+uint64_t get_random_seed() {
+    return master_seed;
+}
+
+Xoshiro256 next_stream() {
+    Xoshiro256 rng(master_seed);
+    int stream = stream_cnt++;
+    for (int i = 0; i < stream; ++i)
+        rng.jump();
+    return rng;
+}
+
+Xoshiro256 &thread_random_engine() {
+    thread_local Xoshiro256 engine = next_stream();
+    return engine;
+}
+
+void reseed_thread_engine() {
+    thread_random_engine() = next_stream();
+}
+
+int sample_index(const float weights[], int n, Xoshiro256 &rng) {
+    float total = 0.0f;
+    for (int i = 0; i < n; ++i)
+        total += weights[i];
+    float target = rng.uniform() * total;
+    int last = 0;
+    for (int i = 0; i < n; ++i) {
+        if (weights[i] <= 0.0f)
+            continue;
+        last = i;
+        target -= weights[i];
+        if (target < 0.0f)
+            return i;
+    }
+    return last;
+}
+
+// Marsaglia & Tsang, alpha < 1 boosted by u^(1/alpha)
+void sample_gamma(float alpha, int n, float out[], Xoshiro256 &rng) {
+    constexpr int block = 64;
+    const bool boost = alpha < 1.0f;
+    const float d = (boost ? alpha + 1.0f : alpha) - 1.0f / 3.0f;
+    const float c = 1.0f / std::sqrt(9.0f * d);
+    float u1[block], u2[block], u3[block], z[block], v[block];
+    bool accept[block];
+    int filled = 0;
+    while (filled < n) {
+        for (int i = 0; i < block; ++i) {
+            u1[i] = 1.0f - rng.uniform();
+            u2[i] = rng.uniform();
+            u3[i] = 1.0f - rng.uniform();
+        }
+        for (int i = 0; i < block; ++i)
+            z[i] = std::sqrt(-2.0f * std::log(u1[i])) * std::cos(6.2831853f * u2[i]);
+        for (int i = 0; i < block; ++i) {
+            float x = 1.0f + c * z[i];
+            v[i] = x * x * x;
+            accept[i] = x > 0.0f && std::log(u3[i]) < 0.5f * z[i] * z[i] + d - d * v[i] + d * std::log(v[i]);
+        }
+        for (int i = 0; i < block && filled < n; ++i)
+            if (accept[i])
+                out[filled++] = d * v[i];
+    }
+    if (boost) {
+        for (int i = 0; i < n; ++i)
+            out[i] *= std::pow(1.0f - rng.uniform(), 1.0f / alpha);
+    }
+}
+
+void sample_dirichlet(float alpha, int n, float out[], Xoshiro256 &rng) {
+    sample_gamma(alpha, n, out, rng);
+    float norm = 0.0f;
+    for (int i = 0; i < n; ++i)
+        norm += out[i];
+    for (int i = 0; i < n; ++i)
+        out[i] = norm > 0.0f ? out[i] / norm : 1.0f / float(n);
+}
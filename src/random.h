@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "vars.h"
+
+/*
+xoshiro256** generator(Blackman & Vigna), usable as UniformRandomBitGenerator for std algorithms
+every thread owns one engine, the n-th thread asking for it gets the master seeded stream jumped n times,
+so streams never overlap and a fixed RANDOM_SEED reproduces runs as long as threads start in the same order
+*/
+class Xoshiro256 {
+    uint64_t s[4];
+public:
+    typedef uint64_t result_type;
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return UINT64_MAX; }
+    explicit Xoshiro256(uint64_t seed = 0) { reseed(seed); }
+    void reseed(uint64_t seed);
+    void jump();
+    std::array<uint64_t, 4> get_state() const { return { { s[0], s[1], s[2], s[3] } }; }
+    void set_state(const std::array<uint64_t, 4> &state) { for (int i = 0; i < 4; ++i) s[i] = state[i]; }
+    result_type operator()() {
+        const uint64_t result = rotl(s[1] * 5, 7) * 9;
+        const uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+    // uniform float in [0, 1)
+    float uniform() { return float((*this)() >> 40) * (1.0f / float(1 << 24)); }
+    // uniform int in [0, n)
+    int below(int n) { return int((((*this)() >> 32) * uint64_t(n)) >> 32); }
+    bool bernoulli(float p) { return uniform() < p; }
+private:
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+};
+
+// master seed of all thread streams, must be called before any thread draws its first number
+// engines already created keep their stream, see reseed_thread_engine
+void set_random_seed(uint64_t seed);
+uint64_t get_random_seed();
+Xoshiro256 &thread_random_engine();
+// moves engine of calling thread onto the next stream of current master seed
+void reseed_thread_engine();
+
+// index drawn with probability proportional to weights[i]
+int sample_index(const float weights[], int n, Xoshiro256 &rng = thread_random_engine());
+// gamma(alpha, 1) and dirichlet(alpha, ..., alpha) of n draws, generated in blocks to let compiler vectorize
+void sample_gamma(float alpha, int n, float out[], Xoshiro256 &rng = thread_random_engine());
+void sample_dirichlet(float alpha, int n, float out[], Xoshiro256 &rng = thread_random_engine());
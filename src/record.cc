@@ -0,0 +1,171 @@
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include "record.h"
+
+template<class T>
+void put_bytes(std::string &bytes, T value) {
+    bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<class T>
+bool get_bytes(const char *&data, const char *end, T &value) {
+    if (end - data < ptrdiff_t(sizeof(T)))
+        return false;
+    std::memcpy(&value, data, sizeof(T));
+    data += sizeof(T);
+    return true;
+}
+
+void GameRecord::add_move(Move mv, const float p_label[]) {
+    moves.push_back(mv);
+    policies.emplace_back();
+    if (p_label == nullptr)
+        return;
+    for (int z = 0; z < BOARD_SIZE; ++z) {
+        auto share = uint16_t(std::lround(p_label[z] * 65535.0f));
+        if (share > 0)
+            policies.back().push_back(std::make_pair(uint16_t(z), share));
+    }
+}
+
+int GameRecord::sample_num() const {
+    int n = 0;
+    for (const auto &policy : policies)
+        n += policy.empty() ? 0 : 1;
+    return n;
+}
+
+void GameRecord::encode(std::string &bytes) const {
+    put_bytes(bytes, int64_t(verno));
+    put_bytes(bytes, int8_t(winner == Color::Black ? 1 : winner == Color::White ? -1 : 0));
+    put_bytes(bytes, uint16_t(moves.size()));
+    for (auto mv : moves)
+        put_bytes(bytes, uint16_t(mv.z()));
+    for (const auto &policy : policies) {
+        put_bytes(bytes, uint16_t(policy.size()));
+        for (const auto &entry : policy) {
+            put_bytes(bytes, entry.first);
+            put_bytes(bytes, entry.second);
+        }
+    }
+}
+
+bool GameRecord::decode(const char *data, size_t size) {
+    const char *end = data + size;
+    int64_t version;
+    int8_t result;
+    uint16_t move_num;
+    if (!get_bytes(data, end, version) || !get_bytes(data, end, result) || !get_bytes(data, end, move_num))
+        return false;
+    verno = version;
+    winner = result > 0 ? Color::Black : result < 0 ? Color::White : Color::Empty;
+    moves.clear();
+    policies.assign(move_num, {});
+    bool used[BOARD_SIZE] = { false };
+    for (int i = 0; i < move_num; ++i) {
+        uint16_t z;
+        if (!get_bytes(data, end, z) || z >= BOARD_SIZE || used[z])
+            return false;
+        used[z] = true;
+        moves.push_back(Move(z));
+    }
+    for (auto &policy : policies) {
+        uint16_t k;
+        if (!get_bytes(data, end, k))
+            return false;
+        for (int j = 0; j < k; ++j) {
+            std::pair<uint16_t, uint16_t> entry;
+            if (!get_bytes(data, end, entry.first) || !get_bytes(data, end, entry.second) || entry.first >= BOARD_SIZE)
+                return false;
+            policy.push_back(entry);
+        }
+    }
+    return data == end;
+}
+
+void GameRecord::to_samples(std::vector<SampleData> &samples) const {
+    State state;
+    for (int i = 0; i < moves.size() && !state.over(); ++i) {
+        if (!policies[i].empty()) {
+            samples.emplace_back();
+            auto &sample = samples.back();
+            state.fill_feature_array(sample.data);
+            for (const auto &entry : policies[i])
+                sample.p_label[entry.first] = entry.second / 65535.0f;
+            if (winner != Color::Empty)
+                sample.v_label[0] = winner == state.current() ? 1.0f : -1.0f;
+        }
+        state.next(moves[i]);
+    }
+}
+
+GameLogWriter::GameLogWriter(const std::string &prefix) : prefix(prefix), segment(0), games(0) {
+    open_next();
+}
+
+void GameLogWriter::open_next() {
+    std::string file_name;
+    for (;;) {
+        std::ostringstream name;
+        name << prefix << "-" << std::setfill('0') << std::setw(6) << ++segment << ".games";
+        file_name = name.str();
+        if (!std::ifstream(file_name).good())
+            break;
+    }
+    out.close();
+    out.clear();
+    out.open(file_name, std::ios::binary);
+    GameSegmentHeader header = {};
+    std::copy(GAME_SEGMENT_MAGIC, GAME_SEGMENT_MAGIC + 4, header.magic);
+    header.version = GAME_SEGMENT_VERSION;
+    header.board_rows = BOARD_MAX_ROW;
+    header.board_cols = BOARD_MAX_COL;
+    header.five_in_row = FIVE_IN_ROW;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.flush();
+    games = 0;
+    LOG(INFO) << "writing game records into " << file_name;
+}
+
+void GameLogWriter::append(const GameRecord &record) {
+    std::string body;
+    record.encode(body);
+    std::string bytes;
+    put_bytes(bytes, uint32_t(body.size()));
+    bytes += body;
+    std::lock_guard<std::mutex> lock(mtx);
+    if (games >= RECORD_SEGMENT_GAMES)
+        open_next();
+    out.write(bytes.data(), bytes.size());
+    out.flush();
+    ++games;
+}
+
+long long read_game_segment(const std::string &file_name, const std::function<void(const GameRecord&)> &visit) {
+    MappedFile file;
+    if (!file.open_read(file_name) || file.size() < sizeof(GameSegmentHeader))
+        return -1;
+    const auto header = reinterpret_cast<const GameSegmentHeader*>(file.data());
+    if (!std::equal(GAME_SEGMENT_MAGIC, GAME_SEGMENT_MAGIC + 4, header->magic)
+            || header->version != GAME_SEGMENT_VERSION || header->board_rows != BOARD_MAX_ROW
+            || header->board_cols != BOARD_MAX_COL || header->five_in_row != FIVE_IN_ROW)
+        return -1;
+    const char *data = file.data() + sizeof(GameSegmentHeader);
+    const char *end = file.data() + file.size();
+    long long count = 0;
+    GameRecord record;
+    uint32_t body_size;
+    while (get_bytes(data, end, body_size) && end - data >= ptrdiff_t(body_size)) {
+        if (!record.decode(data, body_size)) {
+            LOG(INFO) << "stop at corrupted game record " << count << " of " << file_name;
+            break;
+        }
+        visit(record);
+        data += body_size;
+        ++count;
+    }
+    return count;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <fstream>
+#include <functional>
+#include <mutex>
+
+#include "network.h"
+
+static_assert(BOARD_SIZE <= 65535, "moves of game record are stored in two bytes");
+
+/*
+game segment file layout, all integers little-endian:
+  GameSegmentHeader
+  records back to back, each framed as uint32 body length | body
+record body:
+  int64 verno of model which played the game
+  int8 result, 1 black won, -1 white won, 0 draw
+  uint16 move count n, then uint16 move[n]
+  per move uint16 k, then k * (uint16 move, uint16 share of root visits in 1/65535), k is zero if move is no training sample
+a segment is only appended to, reader stops at a record cut short by crash
+*/
+constexpr char GAME_SEGMENT_MAGIC[4] = { 'F', 'I', 'R', 'G' };
+constexpr uint32_t GAME_SEGMENT_VERSION = 2;
+
+struct GameSegmentHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t board_rows;
+    uint32_t board_cols;
+    uint32_t five_in_row;
+    uint32_t reserved;
+};
+
+// one finished selfplay game, enough to regenerate all of its training samples
+struct GameRecord {
+    long long verno = 0;
+    Color winner = Color::Empty;
+    std::vector<Move> moves;
+    std::vector<std::vector<std::pair<uint16_t, uint16_t>>> policies;
+
+    // p_label is search policy of a training sample, nullptr for moves not sampled
+    void add_move(Move mv, const float p_label[]);
+    int sample_num() const;
+    void encode(std::string &bytes) const;
+    bool decode(const char *data, size_t size);
+    // replays the game and appends one sample per sampled move, value from view of side to move
+    void to_samples(std::vector<SampleData> &samples) const;
+};
+
+// appends records to <prefix>-<index>.games, each run starts a new segment and rolls over every RECORD_SEGMENT_GAMES
+class GameLogWriter {
+    std::string prefix;
+    std::ofstream out;
+    int segment;
+    int games;
+    std::mutex mtx;
+    void open_next();
+public:
+    explicit GameLogWriter(const std::string &prefix);
+    void append(const GameRecord &record);
+};
+
+// calls visit on every complete record in segment, returns number of records or -1 if file is no segment of this board
+long long read_game_segment(const std::string &file_name, const std::function<void(const GameRecord&)> &visit);
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include "vars.h"
+
+enum class SearchPhase { Select, Replay, Encode, Evaluate, Expand, Backup, Num };
+
+struct SearchStats {
+    long long phase_ns[int(SearchPhase::Num)];
+    long long think_ns;
+    long long simulations;
+    long long evaluations;
+    long long expanded_nodes;
+    long long depth_sum;
+    int max_depth;
+
+    SearchStats() { reset(); }
+    void reset() {
+        std::fill(std::begin(phase_ns), std::end(phase_ns), 0);
+        think_ns = simulations = evaluations = expanded_nodes = depth_sum = 0;
+        max_depth = 0;
+    }
+    void add_simulation(int depth) {
+        ++simulations;
+        depth_sum += depth;
+        if (depth > max_depth)
+            max_depth = depth;
+    }
+    void merge(const SearchStats &other) {
+        for (int i = 0; i < int(SearchPhase::Num); ++i)
+            phase_ns[i] += other.phase_ns[i];
+        think_ns += other.think_ns;
+        simulations += other.simulations;
+        evaluations += other.evaluations;
+        expanded_nodes += other.expanded_nodes;
+        depth_sum += other.depth_sum;
+        if (other.max_depth > max_depth)
+            max_depth = other.max_depth;
+    }
+    float simulations_per_second() const { return think_ns > 0 ? simulations * 1e9f / think_ns : 0.0f; }
+};
+
+inline std::ostream &operator<<(std::ostream &out, const SearchStats &stats) {
+    static const char *phase_names[] = { "select", "replay", "encode", "evaluate", "expand", "backup" };
+    out << std::fixed << std::setprecision(1)
+        << "sims=" << stats.simulations << ", sims/s=" << stats.simulations_per_second()
+        << ", evals=" << stats.evaluations << ", expanded=" << stats.expanded_nodes
+        << ", depth(avg/max)=" << (stats.simulations > 0 ? float(stats.depth_sum) / stats.simulations : 0.0f)
+        << "/" << stats.max_depth << ", think_ms=" << stats.think_ns / 1e6f;
+    for (int i = 0; i < int(SearchPhase::Num); ++i)
+        out << ", " << phase_names[i] << "_ms=" << stats.phase_ns[i] / 1e6f;
+    return out;
+}
+
+// accumulates elapsed time into stats on destruction, does nothing if stats is null
+class PhaseTimer {
+    long long *target;
+    std::chrono::steady_clock::time_point begin;
+public:
+    PhaseTimer(SearchStats *stats, SearchPhase phase)
+        : target(ENABLE_SEARCH_STATS && stats != nullptr ? &stats->phase_ns[int(phase)] : nullptr) {
+        if (target != nullptr)
+            begin = std::chrono::steady_clock::now();
+    }
+    PhaseTimer(SearchStats *stats)
+        : target(ENABLE_SEARCH_STATS && stats != nullptr ? &stats->think_ns : nullptr) {
+        if (target != nullptr)
+            begin = std::chrono::steady_clock::now();
+    }
+    ~PhaseTimer() {
+        if (target != nullptr)
+            *target += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - begin).count();
+    }
+};
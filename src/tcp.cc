@@ -0,0 +1,160 @@
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <cstring>
+
+#include "tcp.h"
+
+#ifdef _WIN32
+typedef int socklen_t;
+#define CLOSE_SOCKET closesocket
+#define SHUT_RDWR SD_BOTH
+#define SEND_FLAGS 0
+struct WinsockInit {
+    WinsockInit() { WSADATA wsa; WSAStartup(MAKEWORD(2, 2), &wsa); }
+    ~WinsockInit() { WSACleanup(); }
+};
+static WinsockInit winsock_init;
+#else
+#define CLOSE_SOCKET ::close
+#define SEND_FLAGS MSG_NOSIGNAL
+#endif
+
+void encode_u32(uint32_t v, char *out) {
+    for (int i = 0; i < 4; ++i)
+        out[i] = char((v >> (8 * i)) & 0xff);
+}
+
+uint32_t decode_u32(const char *in) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i)
+        v |= uint32_t(static_cast<unsigned char>(in[i])) << (8 * i);
+    return v;
+}
+
+TcpSocket &TcpSocket::operator=(TcpSocket &&other) {
+    if (this != &other) {
+        close();
+        handle = other.handle;
+        other.handle = -1;
+    }
+    return *this;
+}
+
+bool TcpSocket::connect(const std::string &host, int port) {
+    close();
+    addrinfo hints, *result = nullptr;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0)
+        return false;
+    for (auto ai = result; ai != nullptr; ai = ai->ai_next) {
+        auto fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (intptr_t(fd) == -1)
+            continue;
+        if (::connect(fd, ai->ai_addr, socklen_t(ai->ai_addrlen)) == 0) {
+            handle = intptr_t(fd);
+            break;
+        }
+        CLOSE_SOCKET(fd);
+    }
+    freeaddrinfo(result);
+    if (!valid())
+        return false;
+    int nodelay = 1;
+    setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&nodelay), sizeof(nodelay));
+    return true;
+}
+
+bool TcpSocket::listen(int port) {
+    close();
+    auto fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (intptr_t(fd) == -1)
+        return false;
+    handle = intptr_t(fd);
+    int reuse = 1;
+    setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(uint16_t(port));
+    if (bind(handle, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(handle, SOMAXCONN) != 0) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+TcpSocket TcpSocket::accept() {
+    auto fd = ::accept(handle, nullptr, nullptr);
+    TcpSocket conn(intptr_t(fd) == -1 ? -1 : intptr_t(fd));
+    if (conn.valid()) {
+        int nodelay = 1;
+        setsockopt(conn.handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&nodelay), sizeof(nodelay));
+    }
+    return conn;
+}
+
+bool TcpSocket::send_all(const char *data, size_t size) {
+    while (size > 0) {
+        auto n = send(handle, data, int(size > (1 << 20) ? (1 << 20) : size), SEND_FLAGS);
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+bool TcpSocket::recv_all(char *data, size_t size) {
+    while (size > 0) {
+        auto n = recv(handle, data, int(size > (1 << 20) ? (1 << 20) : size), 0);
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+bool TcpSocket::send_message(MsgType type, const std::string &payload) {
+    if (payload.size() > MAX_MSG_PAYLOAD)
+        return false;
+    char header[8];
+    encode_u32(uint32_t(type), header);
+    encode_u32(uint32_t(payload.size()), header + 4);
+    return send_all(header, sizeof(header)) && send_all(payload.data(), payload.size());
+}
+
+bool TcpSocket::recv_message(MsgType &type, std::string &payload) {
+    char header[8];
+    if (!recv_all(header, sizeof(header)))
+        return false;
+    type = MsgType(decode_u32(header));
+    uint32_t size = decode_u32(header + 4);
+    if (size > MAX_MSG_PAYLOAD)
+        return false;
+    payload.resize(size);
+    return size == 0 || recv_all(&payload[0], size);
+}
+
+void TcpSocket::shutdown() {
+    if (valid())
+        ::shutdown(handle, SHUT_RDWR);
+}
+
+void TcpSocket::close() {
+    if (valid())
+        CLOSE_SOCKET(handle);
+    handle = -1;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/*
+every message is framed as:
+  uint32 type | uint32 payload length | payload
+integers little-endian
+
+Game payload is one encoded GameRecord, see record.h
+*/
+enum class MsgType : uint32_t { Hello = 1, Param = 2, Game = 3 };
+constexpr uint32_t MAX_MSG_PAYLOAD = 1u << 30;
+
+class TcpSocket {
+    intptr_t handle;
+public:
+    TcpSocket() : handle(-1) {}
+    explicit TcpSocket(intptr_t h) : handle(h) {}
+    TcpSocket(TcpSocket &&other) : handle(other.handle) { other.handle = -1; }
+    TcpSocket &operator=(TcpSocket &&other);
+    TcpSocket(const TcpSocket &) = delete;
+    TcpSocket &operator=(const TcpSocket &) = delete;
+    ~TcpSocket() { close(); }
+    bool valid() const { return handle != -1; }
+    bool connect(const std::string &host, int port);
+    bool listen(int port);
+    TcpSocket accept();
+    bool send_all(const char *data, size_t size);
+    bool recv_all(char *data, size_t size);
+    bool send_message(MsgType type, const std::string &payload);
+    bool recv_message(MsgType &type, std::string &payload);
+    void shutdown();
+    void close();
+};
@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+
+#include "mcts.h"
+
+constexpr int TEST_ITERMAX = 200;
+
+static int failed = 0;
+
+static void check(bool ok, const std::string &what) {
+    std::cout << (ok ? "[pass] " : "[fail] ") << what << std::endl;
+    if (!ok)
+        ++failed;
+}
+
+static bool legal_reply(const State &state, Move mv) {
+    return mv.z() != NO_MOVE_YET && state.get_board().get(mv) == Color::Empty;
+}
+
+// white holds an open four on row 1 with black to move, tactics expand every black reply in the tree
+// with the winning move only, then white plays elsewhere, a reply the tree never had
+static bool opponent_declines_win(Player &black) {
+    State state;
+    for (int i = 0; i < FIVE_IN_ROW - 1; ++i) {
+        state.next(Move(BOARD_MAX_ROW - 1 - 2 * (i / 2), i % 2 == 0 ? 0 : BOARD_MAX_COL - 1));
+        state.next(Move(1, i + 1));
+    }
+    black.reset();
+    Move first = black.play(state);
+    if (!legal_reply(state, first))
+        return false;
+    state.next(first);
+    Move ends[] = { Move(1, 0), Move(1, FIVE_IN_ROW) };
+    for (int z = 0; z < BOARD_SIZE; ++z) {
+        Move mv(z);
+        if (state.get_board().get(mv) != Color::Empty || mv == ends[0] || mv == ends[1])
+            continue;
+        state.next(mv);
+        break;
+    }
+    return legal_reply(state, black.play(state));
+}
+
+// white answers the opening move at the cell farthest from every stone, beyond candidate range on large boards
+static bool opponent_plays_far(Player &black) {
+    State state;
+    black.reset();
+    Move first = black.play(state);
+    if (!legal_reply(state, first))
+        return false;
+    state.next(first);
+    int far_z = -1, far_dist = -1;
+    for (int z = 0; z < BOARD_SIZE; ++z) {
+        int dist = std::max(std::abs(z / BOARD_MAX_COL - first.z() / BOARD_MAX_COL),
+                            std::abs(z % BOARD_MAX_COL - first.z() % BOARD_MAX_COL));
+        if (dist > far_dist) {
+            far_dist = dist;
+            far_z = z;
+        }
+    }
+    state.next(Move(far_z));
+    return legal_reply(state, black.play(state));
+}
+
+int main() {
+    show_global_cfg(std::cout);
+    {
+        MCTSPurePlayer player(TEST_ITERMAX, C_PUCT);
+        check(opponent_plays_far(player), "MCTSPurePlayer::play after opponent plays out of candidate range");
+    }
+    {
+        MCTSDeepPlayer player(std::make_shared<FIRNet>(0), TEST_ITERMAX, C_PUCT);
+        check(opponent_declines_win(player), "MCTSDeepPlayer::play after opponent skips its forced win");
+        check(opponent_plays_far(player), "MCTSDeepPlayer::play after opponent plays out of candidate range");
+    }
+    std::cout << failed << " test(s) failed" << std::endl;
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,287 @@
+#include <array>
+
+#include "threat.h"
+
+typedef std::array<int, FIVE_IN_ROW> LineWindow;
+
+// every run of FIVE_IN_ROW squares on board
+std::vector<LineWindow> make_line_windows() {
+    std::vector<LineWindow> windows;
+    int direct[4][2] = { { 0, 1 },{ 1, 0 },{ -1, 1 },{ 1, 1 } };
+    for (int r = 0; r < BOARD_MAX_ROW; ++r) {
+        for (int c = 0; c < BOARD_MAX_COL; ++c) {
+            for (auto d : direct) {
+                if (!ON_BOARD(r + d[0] * (FIVE_IN_ROW - 1), c + d[1] * (FIVE_IN_ROW - 1)))
+                    continue;
+                LineWindow window;
+                for (int k = 0; k < FIVE_IN_ROW; ++k)
+                    window[k] = (r + d[0] * k) * BOARD_MAX_COL + c + d[1] * k;
+                windows.push_back(window);
+            }
+        }
+    }
+    return windows;
+}
+
+const std::vector<LineWindow> &line_windows() {
+    static const std::vector<LineWindow> windows = make_line_windows();
+    return windows;
+}
+
+VCFSolver::VCFSolver(const Board &board, int node_limit) : nodes(0), node_limit(node_limit) {
+    for (int z = 0; z < BOARD_SIZE; ++z)
+        grid[z] = board.get(Move(z));
+}
+
+// whether side playing at empty square z completes a five
+bool makes_five(const Color grid[], int z, Color side) {
+    int direct[4][2] = { { 0, 1 },{ 1, 0 },{ -1, 1 },{ 1, 1 } };
+    int row = z / BOARD_MAX_COL, col = z % BOARD_MAX_COL;
+    for (auto d : direct) {
+        int total = 1;
+        for (int s = -1; s <= 1; s += 2) {
+            int r = row + d[0] * s, c = col + d[1] * s;
+            while (ON_BOARD(r, c) && grid[r * BOARD_MAX_COL + c] == side) {
+                ++total;
+                r += d[0] * s;
+                c += d[1] * s;
+            }
+        }
+        if (total >= FIVE_IN_ROW)
+            return true;
+    }
+    return false;
+}
+
+/*
+attacker to move, one pass over line windows finds:
+  window with four attacker stones and no defender stone: attacker wins at its empty square
+  same for defender: attacker must block it, two of them means lost
+  window with three attacker stones and no defender stone: either empty square makes a four, whose five point is the other
+a move with two distinct five points wins at once, one with a single five point forces defender to block there
+*/
+bool VCFSolver::attack(Color attacker, int *first) {
+    if (++nodes > node_limit)
+        return false;
+    Color defender = ~attacker;
+    int five_of[BOARD_SIZE];
+    bool double_four[BOARD_SIZE] = { false };
+    std::fill(five_of, five_of + BOARD_SIZE, NO_MOVE_YET);
+    std::vector<int> fours;
+    int threat = NO_MOVE_YET, threat_n = 0;
+    for (const auto &window : line_windows()) {
+        int own = 0, enemy = 0, empty[FIVE_IN_ROW], empty_n = 0;
+        for (int z : window) {
+            if (grid[z] == attacker)
+                ++own;
+            else if (grid[z] == defender)
+                ++enemy;
+            else
+                empty[empty_n++] = z;
+        }
+        if (enemy == 0 && own == FIVE_IN_ROW - 1) {
+            if (first != nullptr)
+                *first = empty[0];
+            return true;
+        }
+        if (own == 0 && enemy == FIVE_IN_ROW - 1 && empty[0] != threat) {
+            threat = empty[0];
+            ++threat_n;
+        }
+        if (enemy == 0 && own == FIVE_IN_ROW - 2) {
+            for (int k = 0; k < 2; ++k) {
+                int mv = empty[k], five = empty[1 - k];
+                if (five_of[mv] == NO_MOVE_YET) {
+                    five_of[mv] = five;
+                    fours.push_back(mv);
+                }
+                else if (five_of[mv] != five) {
+                    double_four[mv] = true;
+                }
+            }
+        }
+    }
+    if (threat_n >= 2)
+        return false;
+    for (int mv : fours) {
+        if (threat_n == 1 && mv != threat)
+            continue;
+        bool win = double_four[mv];
+        if (!win) {
+            int block = five_of[mv];
+            grid[mv] = attacker;
+            grid[block] = defender;
+            win = !makes_five(grid, block, defender) && attack(attacker, nullptr);
+            grid[block] = Color::Empty;
+            grid[mv] = Color::Empty;
+        }
+        if (win) {
+            if (first != nullptr)
+                *first = mv;
+            return true;
+        }
+        if (nodes > node_limit)
+            return false;
+    }
+    return false;
+}
+
+Move VCFSolver::solve(Color attacker) {
+    int first = NO_MOVE_YET;
+    attack(attacker, &first);
+    return Move(first);
+}
+
+struct ZobristTable {
+    uint64_t keys[2][BOARD_SIZE];
+    ZobristTable() {
+        Xoshiro256 rng(0x5eed);
+        for (auto &side : keys)
+            for (auto &k : side)
+                k = rng();
+    }
+};
+
+uint64_t zobrist_key(Color side, int z) {
+    static const ZobristTable zobrist;
+    return zobrist.keys[side == Color::Black ? 0 : 1][z];
+}
+
+void EndgameSolver::place(int z, Color side) {
+    grid[z] = side;
+    key ^= zobrist_key(side, z);
+}
+
+void EndgameSolver::remove(int z, Color side) {
+    grid[z] = Color::Empty;
+    key ^= zobrist_key(side, z);
+}
+
+/*
+side to move, no five on board yet; values lie in [-1, 1] and are fail-soft
+a five on the next move wins, two enemy five points lose, one of them is the only move worth trying
+*/
+int EndgameSolver::search(Color side, int alpha, int beta) {
+    if (++nodes > node_limit) {
+        aborted = true;
+        return 0;
+    }
+    int threat = NO_MOVE_YET, threat_n = 0, empty_n = 0;
+    for (int z : empties) {
+        if (grid[z] != Color::Empty)
+            continue;
+        ++empty_n;
+        if (makes_five(grid, z, side))
+            return 1;
+        if (makes_five(grid, z, ~side)) {
+            threat = z;
+            ++threat_n;
+        }
+    }
+    if (empty_n == 0)
+        return 0;
+    if (threat_n >= 2)
+        return -1;
+    auto &entry = table[key & (table.size() - 1)];
+    int hint = NO_MOVE_YET;
+    if (entry.key == key) {
+        if (entry.bound == Exact || (entry.bound == Lower && entry.value >= beta)
+            || (entry.bound == Upper && entry.value <= alpha))
+            return entry.value;
+        hint = entry.best;
+    }
+    int alpha_orig = alpha, best = -2, best_z = NO_MOVE_YET;
+    auto try_move = [&](int z) {
+        place(z, side);
+        int v = -search(~side, -beta, -alpha);
+        remove(z, side);
+        if (v > best) {
+            best = v;
+            best_z = z;
+        }
+        alpha = std::max(alpha, best);
+        return aborted || alpha >= beta;
+    };
+    if (threat_n == 1) {
+        try_move(threat);
+    }
+    else if (hint == NO_MOVE_YET || !try_move(hint)) {
+        for (int z : empties) {
+            if (grid[z] == Color::Empty && z != hint && try_move(z))
+                break;
+        }
+    }
+    if (aborted)
+        return 0;
+    entry.key = key;
+    entry.value = int8_t(best);
+    entry.bound = best <= alpha_orig ? Upper : best >= beta ? Lower : Exact;
+    entry.best = int16_t(best_z);
+    return best;
+}
+
+bool EndgameSolver::solve(const State &state, int &value, std::vector<Move> &best_moves) {
+    if (table.empty())
+        table.assign(size_t(1) << ENDGAME_TABLE_BITS, Entry{ 0, 0, Exact, NO_MOVE_YET });
+    key = 0;
+    for (int z = 0; z < BOARD_SIZE; ++z) {
+        grid[z] = state.get_board().get(Move(z));
+        if (grid[z] != Color::Empty)
+            key ^= zobrist_key(grid[z], z);
+    }
+    empties.clear();
+    for (auto mv : state.get_options())
+        empties.push_back(mv.z());
+    nodes = 0;
+    aborted = false;
+    Color side = state.current();
+    value = -2;
+    best_moves.clear();
+    for (int z : empties) {
+        int v = 1;
+        if (!makes_five(grid, z, side)) {
+            place(z, side);
+            v = -search(~side, -1, 1);
+            remove(z, side);
+        }
+        if (aborted)
+            return false;
+        if (v > value) {
+            value = v;
+            best_moves.clear();
+        }
+        if (v == value)
+            best_moves.push_back(Move(z));
+    }
+    return true;
+}
+
+Move EndgameSolver::best_move(const State &state) {
+    int value;
+    std::vector<Move> best_moves;
+    if (state.get_options().size() > ENDGAME_EMPTY_THRESHOLD || !solve(state, value, best_moves))
+        return Move(NO_MOVE_YET);
+    return best_moves[0];
+}
+
+void prune_losing_moves(const State &state, std::vector<std::pair<Move, float>> &move_priors) {
+    Color own_side = state.current();
+    // opponent has no VCF even with an extra tempo, so no single move can lose to one
+    if (VCFSolver(state.get_board()).solve(~own_side).z() == NO_MOVE_YET)
+        return;
+    std::vector<std::pair<Move, float>> kept;
+    float priors_sum = 0.0f;
+    for (const auto &mvp : move_priors) {
+        Board board(state.get_board());
+        board.put(mvp.first, own_side);
+        if (!board.win_from(mvp.first) && VCFSolver(board).solve(~own_side).z() != NO_MOVE_YET)
+            continue;
+        kept.push_back(mvp);
+        priors_sum += mvp.second;
+    }
+    if (kept.empty() || priors_sum <= 0.0f)
+        return;
+    for (auto &mvp : kept)
+        mvp.second /= priors_sum;
+    move_priors.swap(kept);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "game.h"
+
+// threat-space search restricted to continuous fours (VCF), attacker is the side to move
+class VCFSolver {
+    Color grid[BOARD_SIZE];
+    int nodes;
+    int node_limit;
+    bool attack(Color attacker, int *first);
+public:
+    VCFSolver(const Board &board, int node_limit = VCF_NODE_LIMIT);
+    // returns first move of a forced win, or NO_MOVE_YET if none is found within node limit
+    Move solve(Color attacker);
+    int searched() const { return nodes; }
+};
+
+// exact negamax with alpha-beta over remaining empty squares, for positions near the end of game
+// transposition table is allocated on first use and kept across calls, entries hold proven bounds only
+class EndgameSolver {
+    enum Bound : int8_t { Exact, Lower, Upper };
+    struct Entry {
+        uint64_t key;
+        int8_t value;
+        Bound bound;
+        int16_t best;
+    };
+    std::vector<Entry> table;
+    Color grid[BOARD_SIZE];
+    std::vector<int> empties;
+    uint64_t key;
+    int nodes;
+    int node_limit;
+    bool aborted;
+    void place(int z, Color side);
+    void remove(int z, Color side);
+    int search(Color side, int alpha, int beta);
+public:
+    EndgameSolver(int node_limit = ENDGAME_NODE_LIMIT) : node_limit(node_limit) {}
+    // value for side to move(1 win, 0 draw, -1 loss) and every move reaching it, false if node limit is hit first
+    bool solve(const State &state, int &value, std::vector<Move> &best_moves);
+    // first optimal move if state has at most ENDGAME_EMPTY_THRESHOLD empty squares and gets solved, else NO_MOVE_YET
+    Move best_move(const State &state);
+    int searched() const { return nodes; }
+};
+
+// drops moves of side to move after which the opponent has a VCF, unless that would drop every move
+void prune_losing_moves(const State &state, std::vector<std::pair<Move, float>> &move_priors);
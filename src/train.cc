@@ -1,46 +1,183 @@
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
 
 #include "train.h"
 #include "mcts.h"
+#include "tcp.h"
+#include "mapped_file.h"
+#include "record.h"
+
+// exact move once few empty squares are left, all optimal moves share the policy target if p_label is given
+Move solved_move(EndgameSolver &solver, const State &game, float p_label[]) {
+    int value;
+    std::vector<Move> best_moves;
+    if (game.get_options().size() > ENDGAME_EMPTY_THRESHOLD || !solver.solve(game, value, best_moves))
+        return Move(NO_MOVE_YET);
+    if (p_label != nullptr) {
+        std::fill(p_label, p_label + BOARD_SIZE, 0.0f);
+        for (auto mv : best_moves)
+            p_label[mv.z()] = 1.0f / best_moves.size();
+    }
+    return best_moves[thread_random_engine().below(int(best_moves.size()))];
+}
 
-int selfplay(std::shared_ptr<FIRNet> net, DataSet &dataset, int itermax) {
+// one selfplay game as explicit state machine, suspended whenever a leaf needs network evaluation
+class SelfPlayGame {
     State game;
-    std::vector<SampleData> record;
-    MCTSNode *root = new MCTSNode(nullptr, 1.0f);
-    float ind = -1.0f;
-    int step = 0;
-    while (!game.over()) {
-        ++step;
-        ind *= -1.0f;
-        SampleData one_step;
-        *one_step.v_label = ind;
-        game.fill_feature_array(one_step.data);
-        MCTSDeepPlayer::think(itermax, C_PUCT, game, net, root, true);
-        Move act = root->act_by_prob(one_step.p_label, step <= EXPLORE_STEP ? 1.0f : 1e-3);
-        record.push_back(one_step);
-        game.next(act);
-        auto temp = root->cut(act);
-        delete root;
-        root = temp;
-        if (DEBUG_TRAIN_DATA)
-            std::cout << game << std::endl;
+    MCTSNode *root;
+    GameRecord record;
+    int itermax;
+    bool in_move = false;
+    bool full = false;
+    int sims = 0;
+    int sims_target = 0;
+    float p_label[BOARD_SIZE];
+    MCTSNode *leaf = nullptr;
+    State leaf_state;
+    int leaf_depth = 0;
+    EndgameSolver *endgame;
+    void start_move();
+    void finish_move();
+public:
+    SearchStats stats;
+    SelfPlayGame(int itermax, EndgameSolver *endgame)
+        : root(new MCTSNode(nullptr, 1.0f)), itermax(itermax), endgame(endgame) {}
+    ~SelfPlayGame() { delete root; }
+    // runs simulations until a leaf waits for evaluation(returns true) or the game is over(returns false)
+    bool advance();
+    const State &pending() const { return leaf_state; }
+    void feed(float value, std::vector<std::pair<Move, float>> &move_priors);
+    // record of the finished game, moved out
+    GameRecord finish();
+};
+
+void SelfPlayGame::start_move() {
+    full = thread_random_engine().bernoulli(FULL_SEARCH_PROB);
+    sims = 0;
+    sims_target = full ? itermax : TRAIN_FAST_ITERMAX;
+    std::fill(p_label, p_label + BOARD_SIZE, 0.0f);
+    Move solved = solved_move(*endgame, game, full ? p_label : nullptr);
+    if (solved.z() != NO_MOVE_YET) {
+        record.add_move(solved, full ? p_label : nullptr);
+        game.next(solved);
+        root = advance_root(root, solved);
+        return;
     }
+    if (full)
+        root->add_noise_to_child_prior(NOISE_RATE);
+    in_move = true;
+}
+
+void SelfPlayGame::finish_move() {
+    float explore_temp = record.moves.size() < EXPLORE_STEP ? 1.0f : 1e-3;
+    Move act = root->act_by_prob(full ? p_label : nullptr, explore_temp);
+    record.add_move(act, full ? p_label : nullptr);
+    game.next(act);
+    auto temp = root->cut(act);
     delete root;
-    if (game.get_winner() != Color::Empty) {
-        if (ind < 0)
-            for (auto &step : record)
-                (*step.v_label) *= -1;
-    }
-    else {
-        for (auto &step : record)
-            (*step.v_label) = 0.0f;
+    root = temp;
+    in_move = false;
+}
+
+bool SelfPlayGame::advance() {
+    while (!game.over()) {
+        if (!in_move) {
+            start_move();
+            continue;
+        }
+        if (sims >= sims_target) {
+            finish_move();
+            continue;
+        }
+        leaf_state = game;
+        leaf = descend(root, leaf_state, C_PUCT, &leaf_depth);
+        if (!settle_leaf(leaf, leaf_state))
+            return true;
+        ++sims;
+        stats.add_simulation(leaf_depth);
     }
-    for (auto &step : record) {
-        if (DEBUG_TRAIN_DATA)
-            std::cout << step << std::endl;
-        dataset.push_with_transform(&step);
+    return false;
+}
+
+void SelfPlayGame::feed(float value, std::vector<std::pair<Move, float>> &move_priors) {
+    expand_leaf(leaf, leaf_state, value, move_priors);
+    ++sims;
+    ++stats.evaluations;
+    stats.expanded_nodes += move_priors.size();
+    stats.add_simulation(leaf_depth);
+}
+
+GameRecord SelfPlayGame::finish() {
+    record.winner = game.get_winner();
+    return std::move(record);
+}
+
+void selfplay_games(std::shared_ptr<FIRNet> net, int game_num, int itermax,
+        ParamBuffer *param_buf, const GameCallback &on_game) {
+    // every game is played by the net it started on, new weights go into the spare net once its last game is over
+    std::shared_ptr<FIRNet> nets[2] = { net, nullptr };
+    int current = 0;
+    if (net->get_batch_size() < game_num)
+        net->bind_batch(game_num);
+    EndgameSolver endgame;
+    std::vector<std::unique_ptr<SelfPlayGame>> games;
+    std::vector<int> game_net(game_num, current);
+    for (int i = 0; i < game_num; ++i)
+        games.emplace_back(new SelfPlayGame(itermax, &endgame));
+    std::vector<SelfPlayGame*> waiting[2];
+    std::vector<const State*> states[2];
+    std::vector<float> values(game_num);
+    std::vector<std::vector<std::pair<Move, float>>> move_priors;
+    for (;;) {
+        int spare = 1 - current;
+        if (param_buf != nullptr && param_buf->verno() != nets[current]->verno()
+                && std::find(game_net.begin(), game_net.end(), spare) == game_net.end()) {
+            if (nets[spare] == nullptr)
+                nets[spare] = std::make_shared<FIRNet>(*param_buf);
+            else
+                nets[spare]->import_param(*param_buf);
+            if (nets[spare]->get_batch_size() < game_num)
+                nets[spare]->bind_batch(game_num);
+            current = spare;
+        }
+        for (int k = 0; k < 2; ++k) {
+            waiting[k].clear();
+            states[k].clear();
+        }
+        for (int i = 0; i < game_num; ++i) {
+            while (!games[i]->advance()) {
+                GameRecord record = games[i]->finish();
+                record.verno = nets[game_net[i]]->verno();
+                if (!on_game(record, games[i]->stats))
+                    return;
+                games[i].reset(new SelfPlayGame(itermax, &endgame));
+                game_net[i] = current;
+            }
+            waiting[game_net[i]].push_back(games[i].get());
+            states[game_net[i]].push_back(&games[i]->pending());
+        }
+        for (int k = 0; k < 2; ++k) {
+            if (waiting[k].empty())
+                continue;
+            nets[k]->forward_batch(states[k], values.data(), move_priors);
+            for (int i = 0; i < waiting[k].size(); ++i)
+                waiting[k][i]->feed(values[i], move_priors[i]);
+        }
     }
-    return step;
 }
 
 bool trigger_timer(std::chrono::time_point<std::chrono::system_clock> &last, int per_minute) {
@@ -53,47 +190,516 @@ bool trigger_timer(std::chrono::time_point<std::chrono::system_clock> &last, int
     return false;
 }
 
-void train(std::shared_ptr<FIRNet> net) {
-    LOG(INFO) << "start training...";
+class SelfPlayCounter {
+    std::mutex mtx;
+    std::condition_variable cond;
+    long long game_cnt = 0;
+    long long turn_cnt = 0;
+    long long sample_cnt = 0;
+    long long step_cnt = 0;
+    float avg_turn = 0.0f;
+    bool closed = false;
+public:
+    void add_game(int step, int samples) {
+        std::lock_guard<std::mutex> lock(mtx);
+        ++game_cnt;
+        turn_cnt += step;
+        sample_cnt += samples;
+        avg_turn += (step - avg_turn) / float(game_cnt > 10 ? 10 : game_cnt);
+        cond.notify_all();
+    }
+    // false if counter is closed before min_game_cnt is reached
+    bool wait_for_game(long long min_game_cnt) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cond.wait(lock, [&] { return closed || game_cnt >= min_game_cnt; });
+        return game_cnt >= min_game_cnt;
+    }
+    void add_step() {
+        std::lock_guard<std::mutex> lock(mtx);
+        ++step_cnt;
+        cond.notify_all();
+    }
+    void wait_for_steps(long long min_step_cnt) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cond.wait(lock, [&] { return closed || step_cnt >= min_step_cnt; });
+    }
+    void close() {
+        std::lock_guard<std::mutex> lock(mtx);
+        closed = true;
+        cond.notify_all();
+    }
+    long long games() { std::lock_guard<std::mutex> lock(mtx); return game_cnt; }
+    long long positions() { std::lock_guard<std::mutex> lock(mtx); return turn_cnt; }
+    long long samples() { std::lock_guard<std::mutex> lock(mtx); return sample_cnt; }
+    float turns() { std::lock_guard<std::mutex> lock(mtx); return avg_turn; }
+    void restore(long long steps, long long games, long long turns, long long samples) {
+        std::lock_guard<std::mutex> lock(mtx);
+        step_cnt = steps;
+        game_cnt = games;
+        turn_cnt = turns;
+        sample_cnt = samples;
+        avg_turn = games > 0 ? float(turns) / games : 0.0f;
+    }
+};
+
+// cumulative time and work counters of training pipeline, all threads add into it
+struct TrainMetrics {
+    std::atomic<long long> selfplay_ns{ 0 };
+    std::atomic<long long> selfplay_evaluations{ 0 };
+    std::atomic<long long> selfplay_simulations{ 0 };
+    std::atomic<long long> train_ns{ 0 };
+    std::atomic<long long> train_steps{ 0 };
+    std::atomic<long long> benchmark_ns{ 0 };
+    std::atomic<long long> benchmark_runs{ 0 };
+};
+
+long long elapsed_ns(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// regenerates samples of a finished game into dataset and logs its record
+void collect_game(const GameRecord &record, DataSet &dataset, SelfPlayCounter &counter, GameLogWriter *game_log) {
+    std::vector<SampleData> samples;
+    record.to_samples(samples);
+    for (auto &one_step : samples) {
+        if (DEBUG_TRAIN_DATA)
+            std::cout << one_step << std::endl;
+        dataset.push_back(&one_step);
+    }
+    if (game_log != nullptr)
+        game_log->append(record);
+    counter.add_game(int(record.moves.size()), int(samples.size()));
+}
+
+void selfplay_loop(ParamBuffer &param_buf, DataSet &dataset, SelfPlayCounter &counter,
+        TrainMetrics &metrics, GameLogWriter *game_log) {
+    auto net = std::make_shared<FIRNet>(param_buf);
+    auto last = std::chrono::steady_clock::now();
+    selfplay_games(net, SELFPLAY_GAME_NUM, TRAIN_DEEP_ITERMAX, &param_buf,
+            [&](const GameRecord &record, const SearchStats &stats) {
+        metrics.selfplay_ns += elapsed_ns(last);
+        last = std::chrono::steady_clock::now();
+        metrics.selfplay_evaluations += stats.evaluations;
+        metrics.selfplay_simulations += stats.simulations;
+        collect_game(record, dataset, counter, game_log);
+        return true;
+    });
+}
+
+// workers send game records and receive flat parameters, so both formats must match besides the net shape
+std::string config_stamp() {
+    std::ostringstream stamp;
+    stamp << BOARD_MAX_ROW << "x" << BOARD_MAX_COL << "by" << FIVE_IN_ROW << "f" << INPUT_FEATURE_NUM
+        << "n" << NET_NUM_FILTER << "i" << NET_NUM_RESIDUAL_BLOCK << "g" << GAME_SEGMENT_VERSION
+        << "p" << FLAT_PARAM_VERSION;
+    return stamp.str();
+}
+
+void serve_worker(TcpSocket conn, ParamBuffer &param_buf, DataSet &dataset,
+        SelfPlayCounter &counter, GameLogWriter *game_log) {
+    MsgType type;
+    std::string payload;
+    if (!conn.recv_message(type, payload) || type != MsgType::Hello || payload != config_stamp()) {
+        LOG(INFO) << "reject worker with incompatible configure";
+        return;
+    }
+    LOG(INFO) << "worker connected";
+    long long sent_verno = -1;
+    std::string param_bytes;
+    for (;;) {
+        if (param_buf.verno() != sent_verno) {
+            sent_verno = param_buf.verno();
+            param_buf.save_flat(param_bytes);
+            if (!conn.send_message(MsgType::Param, param_bytes))
+                break;
+        }
+        GameRecord record;
+        if (!conn.recv_message(type, payload) || type != MsgType::Game
+                || !record.decode(payload.data(), payload.size()))
+            break;
+        collect_game(record, dataset, counter, game_log);
+    }
+    LOG(INFO) << "worker disconnected";
+}
+
+void accept_workers(int port, ParamBuffer &param_buf, DataSet &dataset,
+        SelfPlayCounter &counter, GameLogWriter *game_log) {
+    TcpSocket listener;
+    if (!listener.listen(port)) {
+        LOG(INFO) << "failed to listen on port " << port;
+        std::exit(-1);
+    }
+    LOG(INFO) << "waiting for workers on port " << port;
+    for (;;) {
+        auto conn = listener.accept();
+        if (conn.valid())
+            std::thread(serve_worker, std::move(conn), std::ref(param_buf),
+                std::ref(dataset), std::ref(counter), game_log).detach();
+    }
+}
+
+bool selfplay_worker(const std::string &host, int port) {
+    TcpSocket conn;
+    MsgType type;
+    std::string payload;
+    ParamBuffer param_buf;
+    if (!conn.connect(host, port) || !conn.send_message(MsgType::Hello, config_stamp())
+            || !conn.recv_message(type, payload) || type != MsgType::Param
+            || !param_buf.load_flat(payload.data(), payload.size())) {
+        LOG(INFO) << "failed to join trainer at " << host << ":" << port;
+        return false;
+    }
+    LOG(INFO) << "joined trainer at " << host << ":" << port;
+    std::atomic<bool> connected(true);
+    std::thread receiver([&] {
+        MsgType msg_type;
+        std::string msg;
+        while (conn.recv_message(msg_type, msg)) {
+            if (msg_type == MsgType::Param && !param_buf.load_flat(msg.data(), msg.size()))
+                break;
+        }
+        connected = false;
+    });
+    auto net = std::make_shared<FIRNet>(param_buf);
+    auto last_log = std::chrono::system_clock::now();
+    long long game_cnt = 0;
+    selfplay_games(net, SELFPLAY_GAME_NUM, TRAIN_DEEP_ITERMAX, &param_buf,
+            [&](const GameRecord &record, const SearchStats &) {
+        std::string game_bytes;
+        record.encode(game_bytes);
+        if (!connected || !conn.send_message(MsgType::Game, game_bytes))
+            return false;
+        ++game_cnt;
+        if (trigger_timer(last_log, MINUTE_PER_LOG))
+            LOG(INFO) << "game_cnt=" << game_cnt << ", net_verno=" << record.verno;
+        return true;
+    });
+    LOG(INFO) << "lost connection to trainer";
+    conn.shutdown();
+    receiver.join();
+    return true;
+}
+
+void lower_thread_priority() {
+#ifdef _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#elif defined(__linux__)
+    setpriority(PRIO_PROCESS, id_t(syscall(SYS_gettid)), 10);
+#endif
+}
+
+void benchmark_snapshot(std::shared_ptr<ParamBuffer> snapshot, std::atomic<int> &test_itermax,
+        std::atomic<bool> &running, TrainMetrics &metrics) {
+    lower_thread_priority();
+    auto begin = std::chrono::steady_clock::now();
+    auto net = std::make_shared<FIRNet>(*snapshot);
+    int itermax = test_itermax;
+    auto test_player = MCTSPurePlayer(itermax, C_PUCT);
+    auto net_player = MCTSDeepPlayer(net, TRAIN_DEEP_ITERMAX, C_PUCT);
+    float lose_prob = 1 - benchmark(net_player, test_player, 10);
+    LOG(INFO) << "benchmark 10 games of " << net_player.name() << " against "
+        << test_player.name() << ", lose_prob=" << lose_prob;
+    if (lose_prob < 1e-3 && itermax < 15 * TEST_PURE_ITERMAX)
+        test_itermax = itermax + TEST_PURE_ITERMAX;
+    metrics.benchmark_ns += elapsed_ns(begin);
+    ++metrics.benchmark_runs;
+    running = false;
+}
+
+std::string make_replay_file_name() {
+    std::ostringstream filename;
+    filename << "FIR-" << BOARD_MAX_COL << "x" << NET_NUM_FILTER
+        << "i" << NET_NUM_RESIDUAL_BLOCK << ".replay";
+    return filename.str();
+}
+
+std::string make_game_log_prefix() {
+    std::ostringstream prefix;
+    prefix << "FIR-" << BOARD_MAX_ROW << "x" << BOARD_MAX_COL;
+    return prefix.str();
+}
+
+std::string make_metrics_file_name() {
+    std::ostringstream filename;
+    filename << "FIR-" << BOARD_MAX_COL << "x" << NET_NUM_FILTER
+        << "i" << NET_NUM_RESIDUAL_BLOCK << ".prom";
+    return filename.str();
+}
+
+/*
+trainer progress saved beside the parameter file of same update_cnt, lets a resumed run keep its pace
+random_seed is a fresh seed drawn at checkpoint, not the state of any engine: a resumed run starts new
+streams from it, and as self-play and prefetch threads draw in timing dependent order, it does not
+reproduce the random numbers the interrupted run would have used
+*/
+struct TrainState {
+    long long step_cnt = 0;
+    long long game_cnt = 0;
+    long long turn_cnt = 0;
+    long long sample_cnt = 0;
+    int test_itermax = TEST_PURE_ITERMAX;
+    uint64_t random_seed = 0;
+};
+
+bool write_train_state(const std::string &file_name, const TrainState &state) {
+    auto tmp_name = file_name + ".tmp";
+    {
+        std::ofstream out(tmp_name);
+        out << "step_cnt=" << state.step_cnt << "\ngame_cnt=" << state.game_cnt
+            << "\nturn_cnt=" << state.turn_cnt << "\nsample_cnt=" << state.sample_cnt
+            << "\ntest_itermax=" << state.test_itermax << "\nrandom_seed=" << state.random_seed << "\n";
+        if (!out.flush())
+            return false;
+    }
+    return replace_file(tmp_name, file_name);
+}
+
+bool read_train_state(const std::string &file_name, TrainState &state) {
+    std::ifstream in(file_name);
+    std::string line;
+    int found = 0;
+    while (std::getline(in, line)) {
+        auto pos = line.find('=');
+        if (pos == std::string::npos)
+            continue;
+        auto key = line.substr(0, pos);
+        std::istringstream value(line.substr(pos + 1));
+        if (key == "step_cnt") found += bool(value >> state.step_cnt);
+        else if (key == "game_cnt") found += bool(value >> state.game_cnt);
+        else if (key == "turn_cnt") found += bool(value >> state.turn_cnt);
+        else if (key == "sample_cnt") found += bool(value >> state.sample_cnt);
+        else if (key == "test_itermax") found += bool(value >> state.test_itermax);
+        else if (key == "random_seed") found += bool(value >> state.random_seed);
+    }
+    return found == 6;
+}
+
+// runs on its own thread, state and optimizer are written before parameters so a complete .param has both
+void save_checkpoint(std::shared_ptr<ParamBuffer> snapshot, std::shared_ptr<ParamBuffer> optimizer,
+        TrainState state, std::string param_file_name, std::string optimizer_file_name, std::string state_file_name) {
+    lower_thread_priority();
+    auto begin = std::chrono::steady_clock::now();
+    if (!write_train_state(state_file_name, state) || !optimizer->save(optimizer_file_name)
+            || !snapshot->save(param_file_name)) {
+        LOG(INFO) << "failed to save checkpoint " << param_file_name;
+        return;
+    }
+    LOG(INFO) << "saved checkpoint " << param_file_name << " in " << elapsed_ns(begin) / 1000000 << "ms";
+}
+
+// snapshots weights, momentum and progress on calling thread, then writes them on save_thread
+void start_checkpoint(std::thread &save_thread, FIRNet &net, SelfPlayCounter &counter,
+        long long step_cnt, int test_itermax) {
+    if (save_thread.joinable())
+        save_thread.join();
+    auto snapshot = std::make_shared<ParamBuffer>();
+    auto optimizer = std::make_shared<ParamBuffer>();
+    net.export_param(*snapshot);
+    net.export_momentum(*optimizer);
+    TrainState state;
+    state.step_cnt = step_cnt;
+    state.game_cnt = counter.games();
+    state.turn_cnt = counter.positions();
+    state.sample_cnt = counter.samples();
+    state.test_itermax = test_itermax;
+    state.random_seed = thread_random_engine()();
+    save_thread = std::thread(save_checkpoint, snapshot, optimizer, state, net.make_param_file_name(),
+        net.make_param_file_name(".opt"), net.make_param_file_name(".state"));
+}
+
+TrainState resume_train_state(FIRNet &net, SelfPlayCounter &counter) {
+    TrainState resumed;
+    if (net.verno() > 0 && read_train_state(net.make_param_file_name(".state"), resumed)) {
+        set_random_seed(resumed.random_seed);
+        reseed_thread_engine();
+        counter.restore(resumed.step_cnt, resumed.game_cnt, resumed.turn_cnt, resumed.sample_cnt);
+        LOG(INFO) << "resumed trainer state, step_cnt=" << resumed.step_cnt << ", game_cnt=" << resumed.game_cnt
+            << ", test_itermax=" << resumed.test_itermax;
+    }
+    return resumed;
+}
+
+void write_metric(std::ostream &out, const char *name, const char *type, const char *help, double value) {
+    out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n"
+        << name << " " << value << "\n";
+}
+
+// prometheus text exposition, meant to be picked up by node_exporter textfile collector
+void write_metrics(const std::string &file_name, SelfPlayCounter &counter, TrainMetrics &metrics,
+        const BatchPrefetcher &prefetcher, const DataSet &dataset, long long update_cnt,
+        std::chrono::steady_clock::time_point start) {
+    double uptime = std::max(elapsed_ns(start) / 1e9, 1e-3);
+    long long games = counter.games(), positions = counter.positions(), samples = counter.samples();
+    long long train_steps = metrics.train_steps;
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3);
+    write_metric(out, "gomoku_selfplay_games_total", "counter", "Self-play games finished since start.", double(games));
+    write_metric(out, "gomoku_selfplay_positions_total", "counter", "Self-play moves played since start.", double(positions));
+    write_metric(out, "gomoku_selfplay_samples_total", "counter", "Samples inserted into replay buffer since start.", double(samples));
+    write_metric(out, "gomoku_selfplay_evaluations_total", "counter", "Network evaluations by local self-play threads.",
+        double(metrics.selfplay_evaluations));
+    write_metric(out, "gomoku_selfplay_simulations_total", "counter", "MCTS simulations by local self-play threads.",
+        double(metrics.selfplay_simulations));
+    write_metric(out, "gomoku_train_steps_total", "counter", "Optimizer steps since start.", double(train_steps));
+    write_metric(out, "gomoku_train_update_cnt", "gauge", "Update count of training net.", double(update_cnt));
+    write_metric(out, "gomoku_replay_total", "gauge", "Slots ever written to replay file.", double(dataset.total()));
+    write_metric(out, "gomoku_replay_merged", "gauge", "Samples merged into slot of an equal position.", double(dataset.merged()));
+    write_metric(out, "gomoku_replay_size", "gauge", "Samples currently held by replay buffer.", double(dataset.size()));
+    write_metric(out, "gomoku_benchmark_runs_total", "counter", "Finished background benchmarks.", double(metrics.benchmark_runs));
+
+    out << "# HELP gomoku_phase_seconds_total Wall time spent per pipeline phase, summed over threads.\n"
+        << "# TYPE gomoku_phase_seconds_total counter\n"
+        << "gomoku_phase_seconds_total{phase=\"selfplay\"} " << metrics.selfplay_ns / 1e9 << "\n"
+        << "gomoku_phase_seconds_total{phase=\"batch\"} " << prefetcher.assemble_time_ns() / 1e9 << "\n"
+        << "gomoku_phase_seconds_total{phase=\"train\"} " << metrics.train_ns / 1e9 << "\n"
+        << "gomoku_phase_seconds_total{phase=\"benchmark\"} " << metrics.benchmark_ns / 1e9 << "\n";
+
+    write_metric(out, "gomoku_uptime_seconds", "gauge", "Seconds since training started.", uptime);
+    write_metric(out, "gomoku_games_per_hour", "gauge", "Average self-play games per hour since start.", games * 3600.0 / uptime);
+    write_metric(out, "gomoku_positions_per_second", "gauge", "Average self-play moves per second since start.", positions / uptime);
+    write_metric(out, "gomoku_evaluations_per_second", "gauge", "Average local network evaluations per second since start.",
+        metrics.selfplay_evaluations / uptime);
+    write_metric(out, "gomoku_train_steps_per_second", "gauge", "Average optimizer steps per second since start.", train_steps / uptime);
+    write_metric(out, "gomoku_sample_reuse_ratio", "gauge", "Samples drawn by training per sample inserted.",
+        samples > 0 ? double(train_steps) * BATCH_SIZE / samples : 0.0);
+
+    std::string tmp_name = file_name + ".tmp";
+    {
+        std::ofstream file(tmp_name, std::ios::binary | std::ios::trunc);
+        file << out.str();
+        if (!file)
+            return;
+    }
+    if (!replace_file(tmp_name, file_name))
+        LOG(INFO) << "failed to write metrics file " << file_name;
+}
+
+void train(std::shared_ptr<FIRNet> net, int selfplay_thread_num, int port) {
+    SelfPlayCounter counter;
+    TrainState resumed = resume_train_state(*net, counter);
+    LOG(INFO) << "start training with random_seed=" << get_random_seed() << "...";
 
     auto last_log = std::chrono::system_clock::now();
     auto last_save = std::chrono::system_clock::now();
     auto last_benchmark = std::chrono::system_clock::now();
+    auto last_metrics = std::chrono::system_clock::now();
+    auto start = std::chrono::steady_clock::now();
 
-    long long game_cnt = 0;
-    float avg_turn = 0.0f;
-    DataSet dataset;
+    DataSet dataset(make_replay_file_name(), net->verno() > 0);
+    TrainMetrics metrics;
+    std::string metrics_file_name = make_metrics_file_name();
+    ParamBuffer param_buf;
+    net->export_param(param_buf);
+    std::vector<std::thread> selfplay_threads;
+    std::unique_ptr<GameLogWriter> game_log;
+    if (ENABLE_GAME_LOG)
+        game_log.reset(new GameLogWriter(make_game_log_prefix()));
+    for (int i = 0; i < selfplay_thread_num; ++i)
+        selfplay_threads.emplace_back(selfplay_loop, std::ref(param_buf),
+            std::ref(dataset), std::ref(counter), std::ref(metrics), game_log.get());
+    if (port > 0)
+        selfplay_threads.emplace_back(accept_workers, port, std::ref(param_buf),
+            std::ref(dataset), std::ref(counter), game_log.get());
 
-    int test_itermax = TEST_PURE_ITERMAX;
-    auto test_player = MCTSPurePlayer(test_itermax, C_PUCT);
-    auto net_player = MCTSDeepPlayer(net, TRAIN_DEEP_ITERMAX, C_PUCT);
+    std::atomic<int> test_itermax(resumed.test_itermax);
+    std::atomic<bool> benchmark_running(false);
+    std::thread benchmark_thread;
+    std::thread save_thread;
 
+    BatchPrefetcher prefetcher(dataset, PREFETCH_BATCH_NUM, PREFETCH_THREAD_NUM);
+    long long step_cnt = resumed.step_cnt;
     for (;;) {
-        ++game_cnt;
-        int step = selfplay(net, dataset, TRAIN_DEEP_ITERMAX);
-        avg_turn += (step - avg_turn) / float(game_cnt > 10 ? 10 : game_cnt);
+        counter.wait_for_game(step_cnt / EPOCH_PER_GAME + 1);
         if (dataset.total() > BATCH_SIZE) {
-            for (int epoch = 0; epoch < EPOCH_PER_GAME; ++epoch) {
-                auto batch = new MiniBatch();
-                dataset.make_mini_batch(batch);
-                float loss = net->train_step(batch);
-                if (trigger_timer(last_log, MINUTE_PER_LOG)) {
-                    LOG(INFO) << "loss=" << loss << ", dataset_total=" << dataset.total() << ", update_cnt="
-                        << net->verno() << ", avg_turn=" << avg_turn << ", game_cnt=" << game_cnt;
-                }
-                delete batch;
+            auto batch = prefetcher.acquire();
+            auto begin = std::chrono::steady_clock::now();
+            float loss = net->train_step(batch);
+            metrics.train_ns += elapsed_ns(begin);
+            ++metrics.train_steps;
+            prefetcher.release(batch);
+            ++step_cnt;
+            if (net->verno() % UPDATE_PER_PUBLISH == 0)
+                net->export_param(param_buf);
+            if (trigger_timer(last_log, MINUTE_PER_LOG)) {
+                LOG(INFO) << "loss=" << loss << ", dataset_total=" << dataset.total() << ", update_cnt="
+                    << net->verno() << ", avg_turn=" << counter.turns() << ", game_cnt=" << counter.games();
             }
         }
-        if (trigger_timer(last_benchmark, MINUTE_PER_BENCHMARK)) {
-            float lose_prob = 1 - benchmark(net_player, test_player, 10);
-            LOG(INFO) << "benchmark 10 games against " << test_player.name() << ", lose_prob=" << lose_prob;
-            if (lose_prob < 1e-3 && test_itermax < 15 * TEST_PURE_ITERMAX) {
-                test_itermax += TEST_PURE_ITERMAX;
-                test_player.set_itermax(test_itermax);
+        else {
+            counter.wait_for_game(counter.games() + 1);
+        }
+        if (!benchmark_running && trigger_timer(last_benchmark, MINUTE_PER_BENCHMARK)) {
+            if (benchmark_thread.joinable())
+                benchmark_thread.join();
+            auto snapshot = std::make_shared<ParamBuffer>();
+            net->export_param(*snapshot);
+            benchmark_running = true;
+            benchmark_thread = std::thread(benchmark_snapshot, snapshot,
+                std::ref(test_itermax), std::ref(benchmark_running), std::ref(metrics));
+        }
+        if (trigger_timer(last_metrics, MINUTE_PER_METRICS)) {
+            write_metrics(metrics_file_name, counter, metrics, prefetcher, dataset, net->verno(), start);
+        }
+        if (trigger_timer(last_save, MINUTE_PER_SAVE))
+            start_checkpoint(save_thread, *net, counter, step_cnt, test_itermax);
+    }
+}
+
+/*
+replays game segments with the dataset and train step pacing of selfplay training:
+once batches can be drawn, loader waits until every loaded game got its EPOCH_PER_GAME steps
+a resumed run skips the games its checkpoint had already loaded, replay buffer refills from the games after them
+*/
+void train_offline(std::shared_ptr<FIRNet> net, const std::vector<std::string> &segments, int passes) {
+    SelfPlayCounter counter;
+    TrainState resumed = resume_train_state(*net, counter);
+    LOG(INFO) << "start offline training on " << segments.size() << " segments, passes=" << passes;
+    auto last_log = std::chrono::system_clock::now();
+    auto last_save = std::chrono::system_clock::now();
+    DataSet dataset;
+    std::thread loader([&] {
+        long long skip = resumed.game_cnt;
+        for (int pass = 0; pass < passes; ++pass) {
+            for (const auto &file_name : segments) {
+                long long n = read_game_segment(file_name, [&](const GameRecord &record) {
+                    if (skip > 0) {
+                        --skip;
+                        return;
+                    }
+                    if (dataset.total() > BATCH_SIZE)
+                        counter.wait_for_steps(counter.games() * EPOCH_PER_GAME);
+                    collect_game(record, dataset, counter, nullptr);
+                });
+                if (n < 0)
+                    LOG(INFO) << "skip " << file_name << ", not a game segment of this board";
             }
         }
-        if (trigger_timer(last_save, MINUTE_PER_SAVE)) {
-            net->save_param();
+        counter.close();
+    });
+
+    std::thread save_thread;
+    BatchPrefetcher prefetcher(dataset, PREFETCH_BATCH_NUM, PREFETCH_THREAD_NUM);
+    long long step_cnt = resumed.step_cnt;
+    while (counter.wait_for_game(step_cnt / EPOCH_PER_GAME + 1)) {
+        if (dataset.total() <= BATCH_SIZE) {
+            if (!counter.wait_for_game(counter.games() + 1))
+                break;
+            continue;
+        }
+        auto batch = prefetcher.acquire();
+        float loss = net->train_step(batch);
+        prefetcher.release(batch);
+        ++step_cnt;
+        counter.add_step();
+        if (trigger_timer(last_log, MINUTE_PER_LOG)) {
+            LOG(INFO) << "loss=" << loss << ", dataset_total=" << dataset.total() << ", update_cnt="
+                << net->verno() << ", avg_turn=" << counter.turns() << ", game_cnt=" << counter.games();
         }
+        if (trigger_timer(last_save, MINUTE_PER_SAVE))
+            start_checkpoint(save_thread, *net, counter, step_cnt, resumed.test_itermax);
     }
-}
\ No newline at end of file
+    loader.join();
+    start_checkpoint(save_thread, *net, counter, step_cnt, resumed.test_itermax);
+    save_thread.join();
+    LOG(INFO) << "finished offline training, game_cnt=" << counter.games() << ", update_cnt=" << net->verno();
+}
@@ -1,6 +1,17 @@
 #pragma once
 
+#include <functional>
+
 #include "network.h"
+#include "record.h"
 
-int selfplay(std::shared_ptr<FIRNet> net, DataSet &dataset, int itermax);
-void train(std::shared_ptr<FIRNet> net);
+// plays game_num games at once on calling thread, leaves of all games are evaluated by one batched forward
+// a new game starts on latest weights of param_buf and keeps them to its end, record.verno tells which
+// on_game receives record and search stats of every finished game, returning false stops the driver
+typedef std::function<bool(const GameRecord &record, const SearchStats &stats)> GameCallback;
+void selfplay_games(std::shared_ptr<FIRNet> net, int game_num, int itermax,
+    ParamBuffer *param_buf, const GameCallback &on_game);
+void train(std::shared_ptr<FIRNet> net, int selfplay_thread_num = SELFPLAY_THREAD_NUM, int port = 0);
+// trains on recorded game segments only, no selfplay
+void train_offline(std::shared_ptr<FIRNet> net, const std::vector<std::string> &segments, int passes);
+bool selfplay_worker(const std::string &host, int port);
@@ -1,6 +1,5 @@
 #pragma once
 
-#include <random>
 #include <iostream>
 
 constexpr int FIVE_IN_ROW = 5;
@@ -9,10 +8,30 @@ constexpr int BOARD_MAX_ROW = BOARD_MAX_COL;
 constexpr int INPUT_FEATURE_NUM = 4; // self, opponent[[, lastmove], color]
 constexpr int BATCH_SIZE = 512;
 constexpr int BUFFER_SIZE = 10000;
-constexpr int EPOCH_PER_GAME = 1;
+constexpr int REPLAY_MERGE_CAP = 32; // repeated positions share a replay slot averaging at most this many latest targets, zero disables merging
+constexpr int EPOCH_PER_GAME = 1; // max train steps per selfplay game
+constexpr int SELFPLAY_THREAD_NUM = 1;
+constexpr int SELFPLAY_GAME_NUM = 32; // games played concurrently by each selfplay thread, sharing batched forwards
+constexpr int UPDATE_PER_PUBLISH = 10;
+constexpr int PREFETCH_BATCH_NUM = 4;
+constexpr int PREFETCH_THREAD_NUM = 2;
+constexpr int TRAIN_REPLICA_NUM = 1;
 constexpr int TEST_PURE_ITERMAX = 1000;
 constexpr int TRAIN_DEEP_ITERMAX = 400;
+constexpr int TRAIN_FAST_ITERMAX = 100;
+constexpr float FULL_SEARCH_PROB = 0.25; // 1.0 disables playout cap randomization
+constexpr bool ENABLE_TACTICS = true; // vcf solver before search and at node expansion
+constexpr int VCF_NODE_LIMIT = 2000;
+constexpr int ENDGAME_EMPTY_THRESHOLD = 10; // positions with at most this many empty squares are solved exactly, zero disables
+constexpr int ENDGAME_NODE_LIMIT = 200000;
+constexpr int ENDGAME_TABLE_BITS = 18;
+constexpr unsigned long long RANDOM_SEED = 0; // master seed of per-thread random streams, zero to seed from device
+constexpr int ANALYZE_BATCH_SIZE = 16; // positions searched in lockstep and evaluated in one forward
+constexpr int ANALYZE_TOP_N = 5;
 constexpr int EXPLORE_STEP = 20;
+// search and rollouts only consider empty cells this close to a stone, zero for whole board
+// tracking costs more than it saves until board is far larger than the neighbourhood
+constexpr int CANDIDATE_DISTANCE = BOARD_MAX_ROW * BOARD_MAX_COL >= 13 * 13 ? 2 : 0;
 constexpr int NET_NUM_FILTER = 64;
 constexpr int NET_NUM_RESIDUAL_BLOCK = 3;
 constexpr int LR_DROP_STEP1 = 2000;
@@ -28,27 +47,52 @@ constexpr bool USE_BATCH_NORM = true;
 constexpr int MINUTE_PER_LOG = 3;
 constexpr int MINUTE_PER_SAVE = 30;
 constexpr int MINUTE_PER_BENCHMARK = 15;
+constexpr int MINUTE_PER_METRICS = 1;
+constexpr bool ENABLE_GAME_LOG = true; // append every selfplay game to FIR-<rows>x<cols>-<index>.games
+constexpr int RECORD_SEGMENT_GAMES = 10000;
+constexpr int LADDER_PAIR_GAMES = 10; // games per pairing, in color swapped pairs from one random opening
+constexpr int LADDER_NEIGHBOR_NUM = 2; // each checkpoint plays this many next newer ones
+constexpr int LADDER_OPENING_MOVES = 4;
+constexpr long long PROTOCOL_TIME_MARGIN_MS = 100; // kept back from every move budget for io and scheduling jitter
+constexpr long long PROTOCOL_MIN_MOVES_TO_GO = 5;
+constexpr long long PROTOCOL_MEMORY_RESERVE_MB = 128; // memory not available to search tree, held by network and runtime
 constexpr int COLOR_OCCUPY_SPACE = 1;
 constexpr float BN_MVAR_INIT = 1.0f;
 
 constexpr bool DEBUG_MCTS_PROB = false;
 constexpr bool DEBUG_TRAIN_DATA = false;
+constexpr bool DEBUG_SEARCH_STATS = false; // log search stats of every move in play and selfplay
+constexpr bool ENABLE_SEARCH_STATS = true; // compile out search stats collection if false
 
 constexpr int BOARD_SIZE = BOARD_MAX_ROW * BOARD_MAX_COL;
 constexpr int NO_MOVE_YET = -1;
-extern std::mt19937 global_random_engine;
 
 inline void show_global_cfg(std::ostream &out) {
     out << "=== global configure ===" << "\ngame_mode=" << BOARD_MAX_ROW << "x" << BOARD_MAX_COL << "by" << FIVE_IN_ROW
         << "\ninput_feature=" << INPUT_FEATURE_NUM << "\nbatch_size=" << BATCH_SIZE
-        << "\nbuffer_size=" << BUFFER_SIZE << "\nepoch_per_game=" << EPOCH_PER_GAME
+        << "\nbuffer_size=" << BUFFER_SIZE << "\nreplay_merge_cap=" << REPLAY_MERGE_CAP << "\nepoch_per_game=" << EPOCH_PER_GAME
+        << "\nselfplay_thread_num=" << SELFPLAY_THREAD_NUM << "\nselfplay_game_num=" << SELFPLAY_GAME_NUM << "\nupdate_per_publish=" << UPDATE_PER_PUBLISH
+        << "\nprefetch_batch_num=" << PREFETCH_BATCH_NUM << "\nprefetch_thread_num=" << PREFETCH_THREAD_NUM
+        << "\ntrain_replica_num=" << TRAIN_REPLICA_NUM
         << "\nc_puct=" << C_PUCT << "\ndirichlet_alpha=" << DIRICHLET_ALPHA
         << "\ninit_learning_rate=" << INIT_LEARNING_RATE << "\nweight_decay=" << WEIGHT_DECAY
         << "\nlr_drop_step1=" << LR_DROP_STEP1 << "\nlr_drop_step2=" << LR_DROP_STEP2
         << "\nlr_drop_step3=" << LR_DROP_STEP3 << "\nuse_batch_norm=" << USE_BATCH_NORM
         << "\nexplore_step=" << EXPLORE_STEP << "\nnoise_rate=" << NOISE_RATE
+        << "\ncandidate_distance=" << CANDIDATE_DISTANCE
         << "\nnet_num_filter=" << NET_NUM_FILTER << "\nnet_num_resudual_block=" << NET_NUM_RESIDUAL_BLOCK
         << "\ntest_pure_itermax=" << TEST_PURE_ITERMAX
         << "\ntrain_deep_itermax=" << TRAIN_DEEP_ITERMAX
+        << "\ntrain_fast_itermax=" << TRAIN_FAST_ITERMAX << "\nfull_search_prob=" << FULL_SEARCH_PROB
+        << "\nrandom_seed=" << RANDOM_SEED
+        << "\nenable_tactics=" << ENABLE_TACTICS << "\nvcf_node_limit=" << VCF_NODE_LIMIT
+        << "\nendgame_empty_threshold=" << ENDGAME_EMPTY_THRESHOLD << "\nendgame_node_limit=" << ENDGAME_NODE_LIMIT
+        << "\nendgame_table_bits=" << ENDGAME_TABLE_BITS
+        << "\nanalyze_batch_size=" << ANALYZE_BATCH_SIZE
+        << "\nenable_game_log=" << ENABLE_GAME_LOG << "\nrecord_segment_games=" << RECORD_SEGMENT_GAMES
+        << "\nladder_pair_games=" << LADDER_PAIR_GAMES << "\nladder_neighbor_num=" << LADDER_NEIGHBOR_NUM
+        << "\nladder_opening_moves=" << LADDER_OPENING_MOVES
+        << "\nprotocol_time_margin_ms=" << PROTOCOL_TIME_MARGIN_MS
+        << "\nprotocol_memory_reserve_mb=" << PROTOCOL_MEMORY_RESERVE_MB
         << "\n" << std::endl;
 }
\ No newline at end of file